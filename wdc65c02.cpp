@@ -1,4 +1,11 @@
 #include "wdc65c02.h"
+#include <algorithm>
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #define NEGATIVE  0x80
 #define OVERFLOW  0x40
@@ -9,25 +16,675 @@
 #define ZERO      0x02
 #define CARRY     0x01
 
+#ifdef WDC65C02_LAZY_FLAGS
+// N and Z are kept as the last result that set them and only folded into
+// status when the whole register is read, see SyncStatus()
+#define SET_NEGATIVE(x) (nValue = (x) ? NEGATIVE : 0)
+#define SET_ZERO(x) (zValue = (x) ? 0 : 1)
+#define SET_NZ(x) (nValue = zValue = (x))
+#else
 #define SET_NEGATIVE(x) (x ? (status |= NEGATIVE) : (status &= (~NEGATIVE)) )
+#define SET_ZERO(x) (x ? (status |= ZERO) : (status &= (~ZERO)) )
+#define SET_NZ(x) (SET_NEGATIVE((x) & NEGATIVE), SET_ZERO(!(x)))
+#endif
 #define SET_OVERFLOW(x) (x ? (status |= OVERFLOW) : (status &= (~OVERFLOW)) )
 //#define SET_CONSTANT(x) (x ? (status |= CONSTANT) : (status &= (~CONSTANT)) )
 //#define SET_BREAK(x) (x ? (status |= BREAK) : (status &= (~BREAK)) )
 #define SET_DECIMAL(x) (x ? (status |= DECIMAL) : (status &= (~DECIMAL)) )
 #define SET_INTERRUPT(x) (x ? (status |= INTERRUPT) : (status &= (~INTERRUPT)) )
-#define SET_ZERO(x) (x ? (status |= ZERO) : (status &= (~ZERO)) )
 #define SET_CARRY(x) (x ? (status |= CARRY) : (status &= (~CARRY)) )
 
-#define IF_NEGATIVE() ((status & NEGATIVE) ? true : false)
 #define IF_OVERFLOW() ((status & OVERFLOW) ? true : false)
 #define IF_CONSTANT() ((status & CONSTANT) ? true : false)
 #define IF_BREAK() ((status & BREAK) ? true : false)
 #define IF_DECIMAL() ((status & DECIMAL) ? true : false)
 #define IF_INTERRUPT() ((status & INTERRUPT) ? true : false)
-#define IF_ZERO() ((status & ZERO) ? true : false)
 #define IF_CARRY() ((status & CARRY) ? true : false)
 
-wdc65c02::Instr wdc65c02::InstrTable[256];
+#ifdef WDC65C02_LAZY_FLAGS
+#define IF_NEGATIVE() ((nValue & NEGATIVE) ? true : false)
+#define IF_ZERO() (zValue ? false : true)
+#else
+#define IF_NEGATIVE() ((status & NEGATIVE) ? true : false)
+#define IF_ZERO() ((status & ZERO) ? true : false)
+#endif
+
+#ifdef WDC65C02_STATS
+#define STATS_OPCODE(opcode) (stats->opcodes[opcode]++)
+#define STATS_EVENT(counter) (stats->counter++)
+#else
+#define STATS_OPCODE(opcode)
+#define STATS_EVENT(counter)
+#endif
+
+#ifndef WDC65C02_NO_PROFILE
+#define CALLS_INTERRUPT() (calls ? EnterInterrupt() : (void)0)
+#define TRACE_INTERRUPT(type) (tracer ? tracer->Enter(type, pc) : (void)0)
+#define TRACE_LINES(cycle) (tracer ? TraceLines(cycle) : (void)0)
+#define TRACE_RELEASE() (traceLines ? (void)(STOP |= 0b00000100) : (void)0)
+#else
+#define CALLS_INTERRUPT()
+#define TRACE_INTERRUPT(type)
+#define TRACE_LINES(cycle)
+#define TRACE_RELEASE()
+#endif
+
+#define PAGE_RAM  0x01 // mapped with MapRAM(), writable memory
+#define PAGE_COW  0x02 // shared with a forked instance
+#define PAGE_CODE 0x04 // holds predecoded blocks
+
+static const int maxInstrCycles = 8; // longest instruction in InstrTable
+
+static const int blockLength = 16;  // max instructions per block
+static const int blockCount = 1024; // cache entries, power of two
+
+struct wdc65c02::Block
+{
+	uint16_t pc;     // address of the first instruction
+	uint16_t end;    // address after the last instruction
+	uint16_t cycles; // sum of the instruction cycles
+	uint16_t hits;   // times run, see TRACE_DISPATCH
+	uint8_t count;   // number of instructions, 0 = empty
+	uint8_t idle;    // loops back to its start without writing memory
+	struct
+	{
+		uint8_t opcode;
+		uint8_t cycles;
+	} instr[blockLength];
+};
+
+static const int traceLength = 64;  // max instructions per trace
+static const int traceCount = 128;  // cache entries, power of two
+static const int hotThreshold = 64; // block runs before it gets a trace
+
+struct wdc65c02::Trace
+{
+	uint16_t pc;     // entry address
+	uint16_t cycles; // sum of the instruction cycles
+	uint8_t count;   // number of instructions, 0 = empty
+	uint8_t idle;    // loops back to its start without writing memory
+	struct
+	{
+		uint8_t opcode;
+		uint8_t cycles;
+		uint8_t length;
+		uint8_t fused;    // FUSE_*, set on the first instruction of a sequence
+		uint16_t address; // of the opcode
+		uint16_t operand; // effective address, see ExecResolved()
+	} instr[traceLength];
+};
+
+// A firmware specific build can add superinstructions generated from an
+// opcode profile by wdc65c02_fusegen.py, by compiling this file with
+// -DWDC65C02_BLOCKS -DWDC65C02_FUSED='"firmware_fused.h"'.
+#ifdef WDC65C02_FUSED
+#include WDC65C02_FUSED
+#else
+#define FUSED_PROFILE_IDS
+#define FUSED_PROFILE_MATCH
+#define FUSED_PROFILE_CASES
+#endif
+
+// superinstructions, frequent sequences run by a single ExecFused() case
+enum
+{
+	FUSE_NONE,
+	FUSE_LDA_STA,     // LDA #/zp/abs, STA zp/abs
+	FUSE_LDA_STA_X,   // LDA abs,X, STA abs,X
+	FUSE_LDA_STA_Y,   // LDA abs,Y, STA abs,Y
+	FUSE_DEX_BNE,
+	FUSE_DEY_BNE,
+	FUSE_INX_CPX_BNE, // CPX #/zp/abs
+	FUSE_INY_CPY_BNE, // CPY #/zp/abs
+	FUSE_CMP_BEQ,     // CMP #/zp/abs, then the branch
+	FUSE_CMP_BNE,
+	FUSE_CMP_BCC,
+	FUSE_CMP_BCS,
+	FUSED_PROFILE_IDS
+};
+
+struct wdc65c02::Scheduler
+{
+	struct Event
+	{
+		uint64_t cycle;
+		uint32_t id; // increasing, keeps events due at the same cycle in order
+		EventCallback callback;
+		void* context;
+	};
+
+	// std::push_heap keeps the largest first, so order by "later"
+	static bool Later(const Event& x, const Event& y)
+	{
+		return x.cycle != y.cycle ? x.cycle > y.cycle : x.id > y.id;
+	}
+
+	std::vector<Event> heap;
+	uint32_t lastId;
+};
+
+struct wdc65c02::Profile
+{
+	uint8_t last[2]; // previous two opcodes, last[1] the most recent
+	uint8_t known;   // how many of them were executed
+	uint64_t pairs[256 * 256];
+	std::unordered_map<uint32_t, uint64_t> triples;
+};
+
+struct wdc65c02::CallProfile
+{
+	// one per distinct call stack, a tree rooted at the top level code
+	struct Node
+	{
+		uint32_t parent;
+		uint16_t address; // entry point of the routine called
+		uint64_t cycles;
+	};
+	struct Frame
+	{
+		uint32_t node;    // exact mode: the call stack inside the call
+		uint16_t address; // sampled mode: interrupt vector and return address
+		uint16_t ret;
+		uint8_t sp;       // S before the call pushed anything
+	};
+
+	uint32_t period; // 0 for exact, otherwise cycles between samples
+	uint32_t event;  // the next sample
+	uint64_t lastSample;
+	bool sampled;
+	std::vector<Node> nodes;
+	std::unordered_map<uint64_t, uint32_t> children; // by (parent << 16) | address
+	std::vector<Frame> frames;
+	std::unordered_map<uint16_t, std::string> labels;
+	uint64_t pcCycles[0x10000];
+
+	uint32_t Child(uint32_t parent, uint16_t address)
+	{
+		uint64_t key = ((uint64_t)parent << 16) | address;
+		std::unordered_map<uint64_t, uint32_t>::const_iterator it = children.find(key);
+		if (it != children.end()) return it->second;
+		Node node = {parent, address, 0};
+		nodes.push_back(node);
+		return children[key] = (uint32_t)(nodes.size() - 1);
+	}
+
+	uint32_t Current()
+	{
+		return frames.empty() ? 0 : frames.back().node;
+	}
+
+	// drops the calls that have returned, S back where it was before them
+	void Unwind(uint8_t sp)
+	{
+		while (!frames.empty() && frames.back().sp <= sp) frames.pop_back();
+	}
+};
+
+// trace records other than instructions, flags 0xC0 | type
+enum
+{
+	TRACE_IRQ = 0xC0,   // interrupt taken, the handler's first instruction follows,
+	                    // in TRACE_BRANCHES mode with where from and to
+	TRACE_NMI = 0xC1,
+	TRACE_LINES = 0xC2, // the IRQ lines (4 bytes) or NMI line (1 byte) changed
+};
+
+// records of a TRACE_BRANCHES block, by the instruction that transferred
+// control
+enum
+{
+	BRANCH_TAKEN,  // Bxx, BBR, BBS
+	BRANCH_JUMP,   // BRA, JMP
+	BRANCH_CALL,   // JSR
+	BRANCH_RETURN, // RTS
+	BRANCH_RTI,
+	BRANCH_BRK,
+	BRANCH_SYNC,   // where execution is at the start of a block
+	BRANCH_NONE = 0x0F,
+	BRANCH_TARGET = 0x10, // the target follows the source
+};
+
+struct wdc65c02::Tracer
+{
+	TraceRing* ring;
+	uint8_t* block;    // being filled, NULL while the ring is full
+	uint32_t used;     // bytes written to it, header included
+	uint32_t records;
+	uint32_t lost;     // records dropped since the last block
+	uint64_t first;    // cycle of the block's first record
+	uint64_t cycle;    // of the previous record
+	uint16_t next;     // pc after the previous instruction
+	uint8_t regs[5];   // A, X, Y, P and S as last recorded
+	bool key;          // nothing in the block to decode the next record from
+	uint8_t kind;      // TraceMode
+	uint8_t entered;   // TRACE_IRQ or TRACE_NMI taken since, or 0
+	uint16_t from;     // and the address it returns to
+	uint8_t kinds[256]; // TRACE_BRANCHES, BRANCH_* by opcode
+	uint32_t irqLines; // as last recorded
+	uint8_t nmiLine;
+
+	// Makes room for a record, starting the next block if needed. While
+	// the ring is full the record is dropped, Run() doesn't wait.
+	bool Reserve(uint64_t at)
+	{
+		if (block && used + 64 > ring->blockSize) Publish();
+		if (!block)
+		{
+			uint32_t head = ring->head.load(std::memory_order_relaxed);
+			if (head - ring->tail.load(std::memory_order_acquire) >= ring->count)
+			{
+				lost++;
+				ring->lost.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+			block = ring->blocks + (size_t)(head % ring->count) * ring->blockSize;
+			used = sizeof(TraceBlock);
+			records = 0;
+			first = cycle = at;
+			key = true;
+		}
+		return true;
+	}
+
+	void Publish()
+	{
+		TraceBlock header;
+		memset(&header, 0, sizeof(header));
+		header.magic = TRACE_MAGIC;
+		header.bytes = used;
+		header.records = records;
+		header.lost = lost;
+		header.cycle = first;
+		header.kind = kind;
+		memcpy(block, &header, sizeof(header));
+		ring->head.store(ring->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		block = NULL;
+		lost = 0;
+		key = true;
+	}
+
+	void Put(uint8_t byte)
+	{
+		block[used++] = byte;
+	}
+
+	void PutAddress(uint16_t address)
+	{
+		Put(address & 0xFF);
+		Put(address >> 8);
+	}
+
+	void Enter(uint8_t type, uint16_t ret)
+	{
+		entered = type;
+		from = ret;
+	}
+
+	// where a TRACE_BRANCHES block starts, the decoder walks on from here
+	void Sync(uint64_t at, uint16_t address)
+	{
+		Put(BRANCH_SYNC | BRANCH_TARGET);
+		PutCycle(at);
+		PutAddress(address);
+		key = false;
+		records++;
+	}
+
+	// cycles since the previous record, 7 bits a byte, low bits first
+	void PutCycle(uint64_t at)
+	{
+		uint64_t delta = at - cycle;
+		cycle = at;
+		while (delta >= 0x80)
+		{
+			Put((uint8_t)(delta | 0x80));
+			delta >>= 7;
+		}
+		Put((uint8_t)delta);
+	}
+};
+
+// InstrTable stores an index into these tables, in AddressingMode order,
+// instead of two member pointers, which take 16 bytes each on most ABIs.
+// An entry is 2 bytes, so the whole decode table fits in 512 bytes.
+#define ADDRESSING_MODES(MODE) \
+	MODE(ABSOL) MODE(ABIXN) MODE(ABSIX) MODE(ABSIY) MODE(ABSIN) MODE(ACCUM) \
+	MODE(IMMED) MODE(IMPLI) MODE(RELAT) MODE(ZEROP) MODE(ZPIXN) MODE(ZRPIX) \
+	MODE(ZRPIY) MODE(ZRPIN) MODE(ZPINY)
+
+// BITS() are the RMB, SMB, BBR and BBS templates, one entry per bit
+#define OPERATIONS(OP, BITS) \
+	OP(ADC) OP(AND) OP(ASL) OP(ASL_ACC) BITS(BBR) BITS(BBS) OP(BCC) \
+	OP(BCS) OP(BEQ) OP(BIT) OP(BIT_IMMED) OP(BMI) OP(BNE) OP(BPL) OP(BRA) \
+	OP(BRK) OP(BVC) OP(BVS) OP(CLC) OP(CLD) OP(CLI) OP(CLV) OP(CMP) \
+	OP(CPX) OP(CPY) OP(DEC) OP(DEC_ACC) OP(DEX) OP(DEY) OP(EOR) OP(INC) \
+	OP(INC_ACC) OP(INX) OP(INY) OP(JMP) OP(JSR) OP(LDA) OP(LDX) OP(LDY) \
+	OP(LSR) OP(LSR_ACC) OP(NOP) OP(ORA) OP(PHA) OP(PHP) OP(PHX) OP(PHY) \
+	OP(PLA) OP(PLP) OP(PLX) OP(PLY) BITS(RMB) OP(ROL) OP(ROL_ACC) OP(ROR) \
+	OP(ROR_ACC) OP(RTI) OP(RTS) OP(SBC) OP(SEC) OP(SED) OP(SEI) BITS(SMB) \
+	OP(STA) OP(STP) OP(STX) OP(STY) OP(STZ) OP(TAX) OP(TAY) OP(TRB) \
+	OP(TSB) OP(TSX) OP(TXA) OP(TXS) OP(TYA) OP(WAI)
+
+#define OP(name) OP_##name,
+#define BITS(name) OP_##name##0, OP_##name##1, OP_##name##2, OP_##name##3, \
+	OP_##name##4, OP_##name##5, OP_##name##6, OP_##name##7,
+
+enum { OPERATIONS(OP, BITS) };
+
+#undef OP
+#undef BITS
+
+#define MODE(name) &wdc65c02::Addr_##name,
+#define OP(name) &wdc65c02::Op_##name,
+#define BITS(name) &wdc65c02::Op_##name<0>, &wdc65c02::Op_##name<1>, \
+	&wdc65c02::Op_##name<2>, &wdc65c02::Op_##name<3>, &wdc65c02::Op_##name<4>, \
+	&wdc65c02::Op_##name<5>, &wdc65c02::Op_##name<6>, &wdc65c02::Op_##name<7>,
+
+constexpr wdc65c02::AddrExec wdc65c02::AddrTable[] = { ADDRESSING_MODES(MODE) };
+constexpr wdc65c02::CodeExec wdc65c02::CodeTable[] = { OPERATIONS(OP, BITS) };
+
+#undef MODE
+#undef OP
+#undef BITS
+
+#define MODE(name) + 1
+static_assert(0 ADDRESSING_MODES(MODE) == wdc65c02::MODE_COUNT,
+	"ADDRESSING_MODES must list the modes in AddressingMode order");
+#undef MODE
+
+// Decode table, indexed by opcode. Every entry is a constant expression, so
+// the whole table is built by the compiler and needs no initialization when
+// an instance is constructed. Reserved opcodes execute as NOPs using the
+// addressing mode of their column.
+constexpr wdc65c02::Instr wdc65c02::InstrTable[256] = {
+	// 0x0_
+	{ OP_BRK,       MODE_IMPLI, 7 }, // 0x00 BRK
+	{ OP_ORA,       MODE_ZPIXN, 6 }, // 0x01 ORA
+	{ OP_NOP,       MODE_IMMED, 2 }, // 0x02 NOP (reserved)
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0x03 NOP (reserved)
+	{ OP_TSB,       MODE_ZEROP, 5 }, // 0x04 TSB
+	{ OP_ORA,       MODE_ZEROP, 3 }, // 0x05 ORA
+	{ OP_ASL,       MODE_ZEROP, 5 }, // 0x06 ASL
+	{ OP_RMB0,      MODE_ZEROP, 5 }, // 0x07 RMB0
+	{ OP_PHP,       MODE_IMPLI, 3 }, // 0x08 PHP
+	{ OP_ORA,       MODE_IMMED, 2 }, // 0x09 ORA
+	{ OP_ASL_ACC,   MODE_ACCUM, 2 }, // 0x0A ASL
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0x0B NOP (reserved)
+	{ OP_TSB,       MODE_ABSOL, 6 }, // 0x0C TSB
+	{ OP_ORA,       MODE_ABSOL, 4 }, // 0x0D ORA
+	{ OP_ASL,       MODE_ABSOL, 6 }, // 0x0E ASL
+	{ OP_BBR0,      MODE_ZEROP, 4 }, // 0x0F BBR0
+
+	// 0x1_
+	{ OP_BPL,       MODE_RELAT, 2 }, // 0x10 BPL
+	{ OP_ORA,       MODE_ZPINY, 5 }, // 0x11 ORA
+	{ OP_ORA,       MODE_ZRPIN, 5 }, // 0x12 ORA
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0x13 NOP (reserved)
+	{ OP_TRB,       MODE_ZEROP, 5 }, // 0x14 TRB
+	{ OP_ORA,       MODE_ZRPIX, 4 }, // 0x15 ORA
+	{ OP_ASL,       MODE_ZRPIX, 6 }, // 0x16 ASL
+	{ OP_RMB1,      MODE_ZEROP, 5 }, // 0x17 RMB1
+	{ OP_CLC,       MODE_IMPLI, 2 }, // 0x18 CLC
+	{ OP_ORA,       MODE_ABSIY, 4 }, // 0x19 ORA
+	{ OP_INC_ACC,   MODE_ACCUM, 2 }, // 0x1A INC
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0x1B NOP (reserved)
+	{ OP_TRB,       MODE_ABSOL, 6 }, // 0x1C TRB
+	{ OP_ORA,       MODE_ABSIX, 4 }, // 0x1D ORA
+	{ OP_ASL,       MODE_ABSIX, 7 }, // 0x1E ASL
+	{ OP_BBR1,      MODE_ZEROP, 4 }, // 0x1F BBR1
+
+	// 0x2_
+	{ OP_JSR,       MODE_ABSOL, 6 }, // 0x20 JSR
+	{ OP_AND,       MODE_ZPIXN, 6 }, // 0x21 AND
+	{ OP_NOP,       MODE_IMMED, 2 }, // 0x22 NOP (reserved)
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0x23 NOP (reserved)
+	{ OP_BIT,       MODE_ZEROP, 3 }, // 0x24 BIT
+	{ OP_AND,       MODE_ZEROP, 3 }, // 0x25 AND
+	{ OP_ROL,       MODE_ZEROP, 5 }, // 0x26 ROL
+	{ OP_RMB2,      MODE_ZEROP, 5 }, // 0x27 RMB2
+	{ OP_PLP,       MODE_IMPLI, 4 }, // 0x28 PLP
+	{ OP_AND,       MODE_IMMED, 2 }, // 0x29 AND
+	{ OP_ROL_ACC,   MODE_ACCUM, 2 }, // 0x2A ROL
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0x2B NOP (reserved)
+	{ OP_BIT,       MODE_ABSOL, 4 }, // 0x2C BIT
+	{ OP_AND,       MODE_ABSOL, 4 }, // 0x2D AND
+	{ OP_ROL,       MODE_ABSOL, 6 }, // 0x2E ROL
+	{ OP_BBR2,      MODE_ZEROP, 4 }, // 0x2F BBR2
+
+	// 0x3_
+	{ OP_BMI,       MODE_RELAT, 2 }, // 0x30 BMI
+	{ OP_AND,       MODE_ZPINY, 5 }, // 0x31 AND
+	{ OP_AND,       MODE_ZRPIN, 5 }, // 0x32 AND
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0x33 NOP (reserved)
+	{ OP_BIT,       MODE_ZRPIX, 4 }, // 0x34 BIT
+	{ OP_AND,       MODE_ZRPIX, 4 }, // 0x35 AND
+	{ OP_ROL,       MODE_ZRPIX, 6 }, // 0x36 ROL
+	{ OP_RMB3,      MODE_ZEROP, 5 }, // 0x37 RMB3
+	{ OP_SEC,       MODE_IMPLI, 2 }, // 0x38 SEC
+	{ OP_AND,       MODE_ABSIY, 4 }, // 0x39 AND
+	{ OP_DEC_ACC,   MODE_ACCUM, 2 }, // 0x3A DEC
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0x3B NOP (reserved)
+	{ OP_BIT,       MODE_ABSIX, 4 }, // 0x3C BIT
+	{ OP_AND,       MODE_ABSIX, 4 }, // 0x3D AND
+	{ OP_ROL,       MODE_ABSIX, 7 }, // 0x3E ROL
+	{ OP_BBR3,      MODE_ZEROP, 4 }, // 0x3F BBR3
+
+	// 0x4_
+	{ OP_RTI,       MODE_IMPLI, 6 }, // 0x40 RTI
+	{ OP_EOR,       MODE_ZPIXN, 6 }, // 0x41 EOR
+	{ OP_NOP,       MODE_IMMED, 2 }, // 0x42 NOP (reserved)
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0x43 NOP (reserved)
+	{ OP_NOP,       MODE_ZEROP, 3 }, // 0x44 NOP (reserved)
+	{ OP_EOR,       MODE_ZEROP, 3 }, // 0x45 EOR
+	{ OP_LSR,       MODE_ZEROP, 5 }, // 0x46 LSR
+	{ OP_RMB4,      MODE_ZEROP, 5 }, // 0x47 RMB4
+	{ OP_PHA,       MODE_IMPLI, 3 }, // 0x48 PHA
+	{ OP_EOR,       MODE_IMMED, 2 }, // 0x49 EOR
+	{ OP_LSR_ACC,   MODE_ACCUM, 2 }, // 0x4A LSR
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0x4B NOP (reserved)
+	{ OP_JMP,       MODE_ABSOL, 3 }, // 0x4C JMP
+	{ OP_EOR,       MODE_ABSOL, 4 }, // 0x4D EOR
+	{ OP_LSR,       MODE_ABSOL, 6 }, // 0x4E LSR
+	{ OP_BBR4,      MODE_ZEROP, 4 }, // 0x4F BBR4
+
+	// 0x5_
+	{ OP_BVC,       MODE_RELAT, 2 }, // 0x50 BVC
+	{ OP_EOR,       MODE_ZPINY, 5 }, // 0x51 EOR
+	{ OP_EOR,       MODE_ZRPIN, 5 }, // 0x52 EOR
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0x53 NOP (reserved)
+	{ OP_NOP,       MODE_ZRPIX, 4 }, // 0x54 NOP (reserved)
+	{ OP_EOR,       MODE_ZRPIX, 4 }, // 0x55 EOR
+	{ OP_LSR,       MODE_ZRPIX, 6 }, // 0x56 LSR
+	{ OP_RMB5,      MODE_ZEROP, 5 }, // 0x57 RMB5
+	{ OP_CLI,       MODE_IMPLI, 2 }, // 0x58 CLI
+	{ OP_EOR,       MODE_ABSIY, 4 }, // 0x59 EOR
+	{ OP_PHY,       MODE_IMPLI, 3 }, // 0x5A PHY
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0x5B NOP (reserved)
+	{ OP_NOP,       MODE_ABSOL, 8 }, // 0x5C NOP (reserved)
+	{ OP_EOR,       MODE_ABSIX, 4 }, // 0x5D EOR
+	{ OP_LSR,       MODE_ABSIX, 7 }, // 0x5E LSR
+	{ OP_BBR5,      MODE_ZEROP, 4 }, // 0x5F BBR5
+
+	// 0x6_
+	{ OP_RTS,       MODE_IMPLI, 6 }, // 0x60 RTS
+	{ OP_ADC,       MODE_ZPIXN, 6 }, // 0x61 ADC
+	{ OP_NOP,       MODE_IMMED, 2 }, // 0x62 NOP (reserved)
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0x63 NOP (reserved)
+	{ OP_STZ,       MODE_ZEROP, 4 }, // 0x64 STZ
+	{ OP_ADC,       MODE_ZEROP, 3 }, // 0x65 ADC
+	{ OP_ROR,       MODE_ZEROP, 5 }, // 0x66 ROR
+	{ OP_RMB6,      MODE_ZEROP, 5 }, // 0x67 RMB6
+	{ OP_PLA,       MODE_IMPLI, 4 }, // 0x68 PLA
+	{ OP_ADC,       MODE_IMMED, 2 }, // 0x69 ADC
+	{ OP_ROR_ACC,   MODE_ACCUM, 2 }, // 0x6A ROR
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0x6B NOP (reserved)
+	{ OP_JMP,       MODE_ABSIN, 6 }, // 0x6C JMP
+	{ OP_ADC,       MODE_ABSOL, 4 }, // 0x6D ADC
+	{ OP_ROR,       MODE_ABSOL, 6 }, // 0x6E ROR
+	{ OP_BBR6,      MODE_ZEROP, 4 }, // 0x6F BBR6
+
+	// 0x7_
+	{ OP_BVS,       MODE_RELAT, 2 }, // 0x70 BVS
+	{ OP_ADC,       MODE_ZPINY, 6 }, // 0x71 ADC
+	{ OP_ADC,       MODE_ZRPIN, 5 }, // 0x72 ADC
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0x73 NOP (reserved)
+	{ OP_STZ,       MODE_ZRPIX, 5 }, // 0x74 STZ
+	{ OP_ADC,       MODE_ZRPIX, 4 }, // 0x75 ADC
+	{ OP_ROR,       MODE_ZRPIX, 6 }, // 0x76 ROR
+	{ OP_RMB7,      MODE_ZEROP, 5 }, // 0x77 RMB7
+	{ OP_SEI,       MODE_IMPLI, 2 }, // 0x78 SEI
+	{ OP_ADC,       MODE_ABSIY, 4 }, // 0x79 ADC
+	{ OP_PLY,       MODE_IMPLI, 4 }, // 0x7A PLY
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0x7B NOP (reserved)
+	{ OP_JMP,       MODE_ABIXN, 6 }, // 0x7C JMP
+	{ OP_ADC,       MODE_ABSIX, 4 }, // 0x7D ADC
+	{ OP_ROR,       MODE_ABSIX, 7 }, // 0x7E ROR
+	{ OP_BBR7,      MODE_ZEROP, 4 }, // 0x7F BBR7
+
+	// 0x8_
+	{ OP_BRA,       MODE_RELAT, 3 }, // 0x80 BRA
+	{ OP_STA,       MODE_ZPIXN, 6 }, // 0x81 STA
+	{ OP_NOP,       MODE_IMMED, 2 }, // 0x82 NOP (reserved)
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0x83 NOP (reserved)
+	{ OP_STY,       MODE_ZEROP, 3 }, // 0x84 STY
+	{ OP_STA,       MODE_ZEROP, 3 }, // 0x85 STA
+	{ OP_STX,       MODE_ZEROP, 3 }, // 0x86 STX
+	{ OP_SMB0,      MODE_ZEROP, 5 }, // 0x87 SMB0
+	{ OP_DEY,       MODE_IMPLI, 2 }, // 0x88 DEY
+	{ OP_BIT_IMMED, MODE_IMMED, 2 }, // 0x89 BIT
+	{ OP_TXA,       MODE_IMPLI, 2 }, // 0x8A TXA
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0x8B NOP (reserved)
+	{ OP_STY,       MODE_ABSOL, 4 }, // 0x8C STY
+	{ OP_STA,       MODE_ABSOL, 4 }, // 0x8D STA
+	{ OP_STX,       MODE_ABSOL, 4 }, // 0x8E STX
+	{ OP_BBS0,      MODE_ZEROP, 4 }, // 0x8F BBS0
+
+	// 0x9_
+	{ OP_BCC,       MODE_RELAT, 2 }, // 0x90 BCC
+	{ OP_STA,       MODE_ZPINY, 6 }, // 0x91 STA
+	{ OP_STA,       MODE_ZRPIN, 6 }, // 0x92 STA
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0x93 NOP (reserved)
+	{ OP_STY,       MODE_ZRPIX, 4 }, // 0x94 STY
+	{ OP_STA,       MODE_ZRPIX, 4 }, // 0x95 STA
+	{ OP_STX,       MODE_ZRPIY, 4 }, // 0x96 STX
+	{ OP_SMB1,      MODE_ZEROP, 5 }, // 0x97 SMB1
+	{ OP_TYA,       MODE_IMPLI, 2 }, // 0x98 TYA
+	{ OP_STA,       MODE_ABSIY, 5 }, // 0x99 STA
+	{ OP_TXS,       MODE_IMPLI, 2 }, // 0x9A TXS
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0x9B NOP (reserved)
+	{ OP_STZ,       MODE_ABSOL, 5 }, // 0x9C STZ
+	{ OP_STA,       MODE_ABSIX, 6 }, // 0x9D STA
+	{ OP_STZ,       MODE_ABSIX, 6 }, // 0x9E STZ
+	{ OP_BBS1,      MODE_ZEROP, 4 }, // 0x9F BBS1
+
+	// 0xA_
+	{ OP_LDY,       MODE_IMMED, 2 }, // 0xA0 LDY
+	{ OP_LDA,       MODE_ZPIXN, 6 }, // 0xA1 LDA
+	{ OP_LDX,       MODE_IMMED, 2 }, // 0xA2 LDX
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0xA3 NOP (reserved)
+	{ OP_LDY,       MODE_ZEROP, 3 }, // 0xA4 LDY
+	{ OP_LDA,       MODE_ZEROP, 3 }, // 0xA5 LDA
+	{ OP_LDX,       MODE_ZEROP, 3 }, // 0xA6 LDX
+	{ OP_SMB2,      MODE_ZEROP, 5 }, // 0xA7 SMB2
+	{ OP_TAY,       MODE_IMPLI, 2 }, // 0xA8 TAY
+	{ OP_LDA,       MODE_IMMED, 2 }, // 0xA9 LDA
+	{ OP_TAX,       MODE_IMPLI, 2 }, // 0xAA TAX
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0xAB NOP (reserved)
+	{ OP_LDY,       MODE_ABSOL, 4 }, // 0xAC LDY
+	{ OP_LDA,       MODE_ABSOL, 4 }, // 0xAD LDA
+	{ OP_LDX,       MODE_ABSOL, 4 }, // 0xAE LDX
+	{ OP_BBS2,      MODE_ZEROP, 4 }, // 0xAF BBS2
+
+	// 0xB_
+	{ OP_BCS,       MODE_RELAT, 2 }, // 0xB0 BCS
+	{ OP_LDA,       MODE_ZPINY, 5 }, // 0xB1 LDA
+	{ OP_LDA,       MODE_ZRPIN, 5 }, // 0xB2 LDA
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0xB3 NOP (reserved)
+	{ OP_LDY,       MODE_ZRPIX, 4 }, // 0xB4 LDY
+	{ OP_LDA,       MODE_ZRPIX, 4 }, // 0xB5 LDA
+	{ OP_LDX,       MODE_ZRPIY, 4 }, // 0xB6 LDX
+	{ OP_SMB3,      MODE_ZEROP, 5 }, // 0xB7 SMB3
+	{ OP_CLV,       MODE_IMPLI, 2 }, // 0xB8 CLV
+	{ OP_LDA,       MODE_ABSIY, 4 }, // 0xB9 LDA
+	{ OP_TSX,       MODE_IMPLI, 2 }, // 0xBA TSX
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0xBB NOP (reserved)
+	{ OP_LDY,       MODE_ABSIX, 4 }, // 0xBC LDY
+	{ OP_LDA,       MODE_ABSIX, 4 }, // 0xBD LDA
+	{ OP_LDX,       MODE_ABSIY, 4 }, // 0xBE LDX
+	{ OP_BBS3,      MODE_ZEROP, 4 }, // 0xBF BBS3
+
+	// 0xC_
+	{ OP_CPY,       MODE_IMMED, 2 }, // 0xC0 CPY
+	{ OP_CMP,       MODE_ZPIXN, 6 }, // 0xC1 CMP
+	{ OP_NOP,       MODE_IMMED, 2 }, // 0xC2 NOP (reserved)
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0xC3 NOP (reserved)
+	{ OP_CPY,       MODE_ZEROP, 3 }, // 0xC4 CPY
+	{ OP_CMP,       MODE_ZEROP, 3 }, // 0xC5 CMP
+	{ OP_DEC,       MODE_ZEROP, 5 }, // 0xC6 DEC
+	{ OP_SMB4,      MODE_ZEROP, 5 }, // 0xC7 SMB4
+	{ OP_INY,       MODE_IMPLI, 2 }, // 0xC8 INY
+	{ OP_CMP,       MODE_IMMED, 2 }, // 0xC9 CMP
+	{ OP_DEX,       MODE_IMPLI, 2 }, // 0xCA DEX
+	{ OP_WAI,       MODE_IMPLI, 5 }, // 0xCB WAI
+	{ OP_CPY,       MODE_ABSOL, 4 }, // 0xCC CPY
+	{ OP_CMP,       MODE_ABSOL, 4 }, // 0xCD CMP
+	{ OP_DEC,       MODE_ABSOL, 6 }, // 0xCE DEC
+	{ OP_BBS4,      MODE_ZEROP, 4 }, // 0xCF BBS4
+
+	// 0xD_
+	{ OP_BNE,       MODE_RELAT, 2 }, // 0xD0 BNE
+	{ OP_CMP,       MODE_ZPINY, 3 }, // 0xD1 CMP
+	{ OP_CMP,       MODE_ZRPIN, 5 }, // 0xD2 CMP
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0xD3 NOP (reserved)
+	{ OP_NOP,       MODE_ZRPIX, 4 }, // 0xD4 NOP (reserved)
+	{ OP_CMP,       MODE_ZRPIX, 4 }, // 0xD5 CMP
+	{ OP_DEC,       MODE_ZRPIX, 6 }, // 0xD6 DEC
+	{ OP_SMB5,      MODE_ZEROP, 5 }, // 0xD7 SMB5
+	{ OP_CLD,       MODE_IMPLI, 2 }, // 0xD8 CLD
+	{ OP_CMP,       MODE_ABSIY, 4 }, // 0xD9 CMP
+	{ OP_PHX,       MODE_IMPLI, 3 }, // 0xDA PHX
+	{ OP_STP,       MODE_IMPLI, 2 }, // 0xDB STP
+	{ OP_NOP,       MODE_ABSIX, 4 }, // 0xDC NOP (reserved)
+	{ OP_CMP,       MODE_ABSIX, 4 }, // 0xDD CMP
+	{ OP_DEC,       MODE_ABSIX, 7 }, // 0xDE DEC
+	{ OP_BBS5,      MODE_ZEROP, 4 }, // 0xDF BBS5
+
+	// 0xE_
+	{ OP_CPX,       MODE_IMMED, 2 }, // 0xE0 CPX
+	{ OP_SBC,       MODE_ZPIXN, 6 }, // 0xE1 SBC
+	{ OP_NOP,       MODE_IMMED, 2 }, // 0xE2 NOP (reserved)
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0xE3 NOP (reserved)
+	{ OP_CPX,       MODE_ZEROP, 3 }, // 0xE4 CPX
+	{ OP_SBC,       MODE_ZEROP, 3 }, // 0xE5 SBC
+	{ OP_INC,       MODE_ZEROP, 5 }, // 0xE6 INC
+	{ OP_SMB6,      MODE_ZEROP, 5 }, // 0xE7 SMB6
+	{ OP_INX,       MODE_IMPLI, 2 }, // 0xE8 INX
+	{ OP_SBC,       MODE_IMMED, 2 }, // 0xE9 SBC
+	{ OP_NOP,       MODE_IMPLI, 2 }, // 0xEA NOP
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0xEB NOP (reserved)
+	{ OP_CPX,       MODE_ABSOL, 4 }, // 0xEC CPX
+	{ OP_SBC,       MODE_ABSOL, 4 }, // 0xED SBC
+	{ OP_INC,       MODE_ABSOL, 6 }, // 0xEE INC
+	{ OP_BBS6,      MODE_ZEROP, 4 }, // 0xEF BBS6
+
+	// 0xF_
+	{ OP_BEQ,       MODE_RELAT, 2 }, // 0xF0 BEQ
+	{ OP_SBC,       MODE_ZPINY, 5 }, // 0xF1 SBC
+	{ OP_SBC,       MODE_ZRPIN, 5 }, // 0xF2 SBC
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0xF3 NOP (reserved)
+	{ OP_NOP,       MODE_ZRPIX, 4 }, // 0xF4 NOP (reserved)
+	{ OP_SBC,       MODE_ZRPIX, 4 }, // 0xF5 SBC
+	{ OP_INC,       MODE_ZRPIX, 6 }, // 0xF6 INC
+	{ OP_SMB7,      MODE_ZEROP, 5 }, // 0xF7 SMB7
+	{ OP_SED,       MODE_IMPLI, 2 }, // 0xF8 SED
+	{ OP_SBC,       MODE_ABSIY, 4 }, // 0xF9 SBC
+	{ OP_PLX,       MODE_IMPLI, 4 }, // 0xFA PLX
+	{ OP_NOP,       MODE_IMPLI, 1 }, // 0xFB NOP (reserved)
+	{ OP_NOP,       MODE_ABSIX, 4 }, // 0xFC NOP (reserved)
+	{ OP_SBC,       MODE_ABSIX, 4 }, // 0xFD SBC
+	{ OP_INC,       MODE_ABSIX, 7 }, // 0xFE INC
+	{ OP_BBS7,      MODE_ZEROP, 4 }, // 0xFF BBS7
+};
 
 wdc65c02::wdc65c02(BusRead r, BusWrite w)
 	: reset_A(0x00)
@@ -36,925 +693,90 @@ wdc65c02::wdc65c02(BusRead r, BusWrite w)
     , reset_sp(0xFD)
     , reset_status(CONSTANT)
 	, STOP(0x00)
-{
-	Write = (BusWrite)w;
-	Read = (BusRead)r;
-
-	static bool initialized = false;
-	if (initialized) return;
-	initialized = true;
-
-	Instr instr;
-	// fill jump table with NOPs
-	// 0x_3 and 0x_B
-	instr.code = &wdc65c02::Op_NOP;
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.cycles = 1;
-	for(int i = 0; i < 256; i++)
-	{
-		InstrTable[i] = instr;
-	}
-
-	// 0x_2
-	instr.addr = &wdc65c02::Addr_IMMED;
-	instr.cycles = 2;
-	for (int i = 0; i < 0x10; i++) 
-	{
-		InstrTable[(i << 4) + 0x02] = instr;
-	}
-
-	// 0x_4
-	instr.addr = &wdc65c02::Addr_ZRPIX;
-	instr.cycles = 4;
-	for (int i = 0; i < 0x10; i++) 
-	{
-		InstrTable[(i << 4) + 0x04] = instr;
-	}
-
-	instr.addr = &wdc65c02::Addr_ZEROP;
-	instr.cycles = 3;
-	InstrTable[0x44] = instr;
-
-	// 0x_C
-	instr.addr = &wdc65c02::Addr_ABSIX;
-	instr.cycles = 4;
-	for (int i = 0; i < 0x10; i++) 
-	{
-		InstrTable[(i << 4) + 0x0c] = instr;
-	}
-
-	instr.addr = &wdc65c02::Addr_ABSOL;
-	instr.cycles = 8;
-	InstrTable[0x5C] = instr;
-
-
-	// insert opcodes
-
-	instr.addr = &wdc65c02::Addr_ABSOL;
-	instr.code = &wdc65c02::Op_ADC;
-	instr.cycles = 4;
-	InstrTable[0x6D] = instr;
-	instr.addr = &wdc65c02::Addr_ABSIX;
-	instr.code = &wdc65c02::Op_ADC;
-	instr.cycles = 4;
-	InstrTable[0x7D] = instr;
-	instr.addr = &wdc65c02::Addr_ABSIY;
-	instr.code = &wdc65c02::Op_ADC;
-	instr.cycles = 4;
-	InstrTable[0x79] = instr;
-	instr.addr = &wdc65c02::Addr_IMMED;
-	instr.code = &wdc65c02::Op_ADC;
-	instr.cycles = 2;
-	InstrTable[0x69] = instr;
-	instr.addr = &wdc65c02::Addr_ZEROP;
-	instr.code = &wdc65c02::Op_ADC;
-	instr.cycles = 3;
-	InstrTable[0x65] = instr;
-	instr.addr = &wdc65c02::Addr_ZPIXN;
-	instr.code = &wdc65c02::Op_ADC;
-	instr.cycles = 6;
-	InstrTable[0x61] = instr;
-	instr.addr = &wdc65c02::Addr_ZRPIX;
-	instr.code = &wdc65c02::Op_ADC;
-	instr.cycles = 4;
-	InstrTable[0x75] = instr;
-	instr.addr = &wdc65c02::Addr_ZRPIN;
-	instr.code = &wdc65c02::Op_ADC;
-	instr.cycles = 5;
-	InstrTable[0x72] = instr; // New adressing mode
-	instr.addr = &wdc65c02::Addr_ZPINY;
-	instr.code = &wdc65c02::Op_ADC;
-	instr.cycles = 6;
-	InstrTable[0x71] = instr;
-
-	instr.addr = &wdc65c02::Addr_ABSOL;
-	instr.code = &wdc65c02::Op_AND;
-	instr.cycles = 4;
-	InstrTable[0x2D] = instr;
-	instr.addr = &wdc65c02::Addr_ABSIX;
-	instr.code = &wdc65c02::Op_AND;
-	instr.cycles = 4;
-	InstrTable[0x3D] = instr;
-	instr.addr = &wdc65c02::Addr_ABSIY;
-	instr.code = &wdc65c02::Op_AND;
-	instr.cycles = 4;
-	InstrTable[0x39] = instr;
-	instr.addr = &wdc65c02::Addr_IMMED;
-	instr.code = &wdc65c02::Op_AND;
-	instr.cycles = 2;
-	InstrTable[0x29] = instr;
-	instr.addr = &wdc65c02::Addr_ZEROP;
-	instr.code = &wdc65c02::Op_AND;
-	instr.cycles = 3;
-	InstrTable[0x25] = instr;
-	instr.addr = &wdc65c02::Addr_ZPIXN;
-	instr.code = &wdc65c02::Op_AND;
-	instr.cycles = 6;
-	InstrTable[0x21] = instr;
-	instr.addr = &wdc65c02::Addr_ZRPIX;
-	instr.code = &wdc65c02::Op_AND;
-	instr.cycles = 4;
-	InstrTable[0x35] = instr;
-	instr.addr = &wdc65c02::Addr_ZRPIN;
-	instr.code = &wdc65c02::Op_AND;
-	instr.cycles = 5;
-	InstrTable[0x32] = instr; // New adressing mode
-	instr.addr = &wdc65c02::Addr_ZPINY;
-	instr.code = &wdc65c02::Op_AND;
-	instr.cycles = 5;
-	InstrTable[0x31] = instr;
-
-	instr.addr = &wdc65c02::Addr_ABSOL;
-	instr.code = &wdc65c02::Op_ASL;
-	instr.cycles = 6;
-	InstrTable[0x0E] = instr;
-	instr.addr = &wdc65c02::Addr_ABSIX;
-	instr.code = &wdc65c02::Op_ASL;
-	instr.cycles = 7;
-	InstrTable[0x1E] = instr;
-	instr.addr = &wdc65c02::Addr_ACCUM;
-	instr.code = &wdc65c02::Op_ASL_ACC;
-	instr.cycles = 2;
-	InstrTable[0x0A] = instr;
-	instr.addr = &wdc65c02::Addr_ZEROP;
-	instr.code = &wdc65c02::Op_ASL;
-	instr.cycles = 5;
-	InstrTable[0x06] = instr;
-	instr.addr = &wdc65c02::Addr_ZRPIX;
-	instr.code = &wdc65c02::Op_ASL;
-	instr.cycles = 6;
-	InstrTable[0x16] = instr;
-
-	// BBR (NEW INSTRUCTION)
-	instr.addr = &wdc65c02::Addr_ZEROP; // ZERO PAGE, RELATIVE
-	instr.cycles = 4;
-	instr.code = &wdc65c02::Op_BBR0;
-	InstrTable[0x0F] = instr;
-	instr.code = &wdc65c02::Op_BBR1;
-	InstrTable[0x1F] = instr;
-	instr.code = &wdc65c02::Op_BBR2;
-	InstrTable[0x2F] = instr;
-	instr.code = &wdc65c02::Op_BBR3;
-	InstrTable[0x3F] = instr;
-	instr.code = &wdc65c02::Op_BBR4;
-	InstrTable[0x4F] = instr;
-	instr.code = &wdc65c02::Op_BBR5;
-	InstrTable[0x5F] = instr;
-	instr.code = &wdc65c02::Op_BBR6;
-	InstrTable[0x6F] = instr;
-	instr.code = &wdc65c02::Op_BBR7;
-	InstrTable[0x7F] = instr;
-
-	// BBS (NEW INSTRUCTION)
-	instr.code = &wdc65c02::Op_BBS0;
-	InstrTable[0x8F] = instr;
-	instr.code = &wdc65c02::Op_BBS1;
-	InstrTable[0x9F] = instr;
-	instr.code = &wdc65c02::Op_BBS2;
-	InstrTable[0xAF] = instr;
-	instr.code = &wdc65c02::Op_BBS3;
-	InstrTable[0xBF] = instr;
-	instr.code = &wdc65c02::Op_BBS4;
-	InstrTable[0xCf] = instr;
-	instr.code = &wdc65c02::Op_BBS5;
-	InstrTable[0xDF] = instr;
-	instr.code = &wdc65c02::Op_BBS6;
-	InstrTable[0xEF] = instr;
-	instr.code = &wdc65c02::Op_BBS7;
-	InstrTable[0xFF] = instr;
-
-	instr.addr = &wdc65c02::Addr_RELAT;
-	instr.code = &wdc65c02::Op_BCC;
-	instr.cycles = 2;
-	InstrTable[0x90] = instr;
-
-	instr.addr = &wdc65c02::Addr_RELAT;
-	instr.code = &wdc65c02::Op_BCS;
-	instr.cycles = 2;
-	InstrTable[0xB0] = instr;
-
-	instr.addr = &wdc65c02::Addr_RELAT;
-	instr.code = &wdc65c02::Op_BEQ;
-	instr.cycles = 2;
-	InstrTable[0xF0] = instr;
-
-	instr.addr = &wdc65c02::Addr_ABSOL;
-	instr.code = &wdc65c02::Op_BIT;
-	instr.cycles = 4;
-	InstrTable[0x2C] = instr;
-	instr.addr = &wdc65c02::Addr_ABSIX;
-	instr.code = &wdc65c02::Op_BIT;
-	instr.cycles = 4;
-	InstrTable[0x3C] = instr; // New adressing mode
-	instr.addr = &wdc65c02::Addr_IMMED;
-	instr.code = &wdc65c02::Op_BIT_IMMED;
-	instr.cycles = 2;
-	InstrTable[0x89] = instr; // New adressing mode
-	instr.addr = &wdc65c02::Addr_ZEROP;
-	instr.code = &wdc65c02::Op_BIT;
-	instr.cycles = 3;
-	InstrTable[0x24] = instr;
-	instr.addr = &wdc65c02::Addr_ZRPIX;
-	instr.code = &wdc65c02::Op_BIT;
-	instr.cycles = 4;
-	InstrTable[0x34] = instr; // New adressing mode
-
-	instr.addr = &wdc65c02::Addr_RELAT;
-	instr.code = &wdc65c02::Op_BMI;
-	instr.cycles = 2;
-	InstrTable[0x30] = instr;
-
-	instr.addr = &wdc65c02::Addr_RELAT;
-	instr.code = &wdc65c02::Op_BNE;
-	instr.cycles = 2;
-	InstrTable[0xD0] = instr;
-
-	instr.addr = &wdc65c02::Addr_RELAT;
-	instr.code = &wdc65c02::Op_BPL;
-	instr.cycles = 2;
-	InstrTable[0x10] = instr;
-
-	instr.addr = &wdc65c02::Addr_RELAT;
-	instr.code = &wdc65c02::Op_BRA;  // NEW INSTRUCTION
-	instr.cycles = 3;
-	InstrTable[0x80] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_BRK;
-	instr.cycles = 7;
-	InstrTable[0x00] = instr;
-
-	instr.addr = &wdc65c02::Addr_RELAT;
-	instr.code = &wdc65c02::Op_BVC;
-	instr.cycles = 2;
-	InstrTable[0x50] = instr;
-
-	instr.addr = &wdc65c02::Addr_RELAT;
-	instr.code = &wdc65c02::Op_BVS;
-	instr.cycles = 2;
-	InstrTable[0x70] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_CLC;
-	instr.cycles = 2;
-	InstrTable[0x18] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_CLD;
-	instr.cycles = 2;
-	InstrTable[0xD8] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_CLI;
-	instr.cycles = 2;
-	InstrTable[0x58] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_CLV;
-	instr.cycles = 2;
-	InstrTable[0xB8] = instr;
-
-	instr.addr = &wdc65c02::Addr_ABSOL;
-	instr.code = &wdc65c02::Op_CMP;
-	instr.cycles = 4;
-	InstrTable[0xCD] = instr;
-	instr.addr = &wdc65c02::Addr_ABSIX;
-	instr.code = &wdc65c02::Op_CMP;
-	instr.cycles = 4;
-	InstrTable[0xDD] = instr;
-	instr.addr = &wdc65c02::Addr_ABSIY;
-	instr.code = &wdc65c02::Op_CMP;
-	instr.cycles = 4;
-	InstrTable[0xD9] = instr;
-	instr.addr = &wdc65c02::Addr_IMMED;
-	instr.code = &wdc65c02::Op_CMP;
-	instr.cycles = 2;
-	InstrTable[0xC9] = instr;
-	instr.addr = &wdc65c02::Addr_ZEROP;
-	instr.code = &wdc65c02::Op_CMP;
-	instr.cycles = 3;
-	InstrTable[0xC5] = instr;
-	instr.addr = &wdc65c02::Addr_ZPIXN;
-	instr.code = &wdc65c02::Op_CMP;
-	instr.cycles = 6;
-	InstrTable[0xC1] = instr;
-	instr.addr = &wdc65c02::Addr_ZRPIX;
-	instr.code = &wdc65c02::Op_CMP;
-	instr.cycles = 4;
-	InstrTable[0xD5] = instr;
-	instr.addr = &wdc65c02::Addr_ZRPIN;
-	instr.code = &wdc65c02::Op_CMP;
-	instr.cycles = 5;
-	InstrTable[0xD2] = instr; // New adressing mode
-	instr.addr = &wdc65c02::Addr_ZPINY;
-	instr.code = &wdc65c02::Op_CMP;
-	instr.cycles = 3;
-	InstrTable[0xD1] = instr;
-
-	instr.addr = &wdc65c02::Addr_ABSOL;
-	instr.code = &wdc65c02::Op_CPX;
-	instr.cycles = 4;
-	InstrTable[0xEC] = instr;
-	instr.addr = &wdc65c02::Addr_IMMED;
-	instr.code = &wdc65c02::Op_CPX;
-	instr.cycles = 2;
-	InstrTable[0xE0] = instr;
-	instr.addr = &wdc65c02::Addr_ZEROP;
-	instr.code = &wdc65c02::Op_CPX;
-	instr.cycles = 3;
-	InstrTable[0xE4] = instr;
-
-	instr.addr = &wdc65c02::Addr_ABSOL;
-	instr.code = &wdc65c02::Op_CPY;
-	instr.cycles = 4;
-	InstrTable[0xCC] = instr;
-	instr.addr = &wdc65c02::Addr_IMMED;
-	instr.code = &wdc65c02::Op_CPY;
-	instr.cycles = 2;
-	InstrTable[0xC0] = instr;
-	instr.addr = &wdc65c02::Addr_ZEROP;
-	instr.code = &wdc65c02::Op_CPY;
-	instr.cycles = 3;
-	InstrTable[0xC4] = instr;
-
-	instr.addr = &wdc65c02::Addr_ABSOL;
-	instr.code = &wdc65c02::Op_DEC;
-	instr.cycles = 6;
-	InstrTable[0xCE] = instr;
-	instr.addr = &wdc65c02::Addr_ABSIX;
-	instr.code = &wdc65c02::Op_DEC;
-	instr.cycles = 7;
-	InstrTable[0xDE] = instr;
-	instr.addr = &wdc65c02::Addr_ACCUM;
-	instr.code = &wdc65c02::Op_DEC_ACC;
-	instr.cycles = 2;
-	InstrTable[0x3A] = instr; // New adressing mode
-	instr.addr = &wdc65c02::Addr_ZEROP;
-	instr.code = &wdc65c02::Op_DEC;
-	instr.cycles = 5;
-	InstrTable[0xC6] = instr;
-	instr.addr = &wdc65c02::Addr_ZRPIX;
-	instr.code = &wdc65c02::Op_DEC;
-	instr.cycles = 6;
-	InstrTable[0xD6] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_DEX;
-	instr.cycles = 2;
-	InstrTable[0xCA] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_DEY;
-	instr.cycles = 2;
-	InstrTable[0x88] = instr;
-
-	instr.addr = &wdc65c02::Addr_ABSOL;
-	instr.code = &wdc65c02::Op_EOR;
-	instr.cycles = 4;
-	InstrTable[0x4D] = instr;
-	instr.addr = &wdc65c02::Addr_ABSIX;
-	instr.code = &wdc65c02::Op_EOR;
-	instr.cycles = 4;
-	InstrTable[0x5D] = instr;
-	instr.addr = &wdc65c02::Addr_ABSIY;
-	instr.code = &wdc65c02::Op_EOR;
-	instr.cycles = 4;
-	InstrTable[0x59] = instr;
-	instr.addr = &wdc65c02::Addr_IMMED;
-	instr.code = &wdc65c02::Op_EOR;
-	instr.cycles = 2;
-	InstrTable[0x49] = instr;
-	instr.addr = &wdc65c02::Addr_ZEROP;
-	instr.code = &wdc65c02::Op_EOR;
-	instr.cycles = 3;
-	InstrTable[0x45] = instr;
-	instr.addr = &wdc65c02::Addr_ZPIXN;
-	instr.code = &wdc65c02::Op_EOR;
-	instr.cycles = 6;
-	InstrTable[0x41] = instr;
-	instr.addr = &wdc65c02::Addr_ZRPIX;
-	instr.code = &wdc65c02::Op_EOR;
-	instr.cycles = 4;
-	InstrTable[0x55] = instr;
-	instr.addr = &wdc65c02::Addr_ZRPIN;
-	instr.code = &wdc65c02::Op_EOR;
-	instr.cycles = 5;
-	InstrTable[0x52] = instr; // New adressing mode
-	instr.addr = &wdc65c02::Addr_ZPINY;
-	instr.code = &wdc65c02::Op_EOR;
-	instr.cycles = 5;
-	InstrTable[0x51] = instr;
-
-	instr.addr = &wdc65c02::Addr_ABSOL;
-	instr.code = &wdc65c02::Op_INC;
-	instr.cycles = 6;
-	InstrTable[0xEE] = instr;
-	instr.addr = &wdc65c02::Addr_ABSIX;
-	instr.code = &wdc65c02::Op_INC;
-	instr.cycles = 7;
-	InstrTable[0xFE] = instr;
-	instr.addr = &wdc65c02::Addr_ACCUM;
-	instr.code = &wdc65c02::Op_INC_ACC;
-	instr.cycles = 2;
-	InstrTable[0x1A] = instr; // New adressing mode
-	instr.addr = &wdc65c02::Addr_ZEROP;
-	instr.code = &wdc65c02::Op_INC;
-	instr.cycles = 5;
-	InstrTable[0xE6] = instr;
-	instr.addr = &wdc65c02::Addr_ZRPIX;
-	instr.code = &wdc65c02::Op_INC;
-	instr.cycles = 6;
-	InstrTable[0xF6] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_INX;
-	instr.cycles = 2;
-	InstrTable[0xE8] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_INY;
-	instr.cycles = 2;
-	InstrTable[0xC8] = instr;
-
-	instr.addr = &wdc65c02::Addr_ABSOL;
-	instr.code = &wdc65c02::Op_JMP;
-	instr.cycles = 3;
-	InstrTable[0x4C] = instr;
-	instr.addr = &wdc65c02::Addr_ABIXN;
-	instr.code = &wdc65c02::Op_JMP;
-	instr.cycles = 6;
-	InstrTable[0x7C] = instr; // New adressing mode
-	instr.addr = &wdc65c02::Addr_ABSIN;
-	instr.code = &wdc65c02::Op_JMP;
-	instr.cycles = 6;
-	InstrTable[0x6C] = instr;
-
-	instr.addr = &wdc65c02::Addr_ABSOL;
-	instr.code = &wdc65c02::Op_JSR;
-	instr.cycles = 6;
-	InstrTable[0x20] = instr;
-
-	instr.addr = &wdc65c02::Addr_ABSOL;
-	instr.code = &wdc65c02::Op_LDA;
-	instr.cycles = 4;
-	InstrTable[0xAD] = instr;
-	instr.addr = &wdc65c02::Addr_ABSIX;
-	instr.code = &wdc65c02::Op_LDA;
-	instr.cycles = 4;
-	InstrTable[0xBD] = instr;
-	instr.addr = &wdc65c02::Addr_ABSIY;
-	instr.code = &wdc65c02::Op_LDA;
-	instr.cycles = 4;
-	InstrTable[0xB9] = instr;
-	instr.addr = &wdc65c02::Addr_IMMED;
-	instr.code = &wdc65c02::Op_LDA;
-	instr.cycles = 2;
-	InstrTable[0xA9] = instr;
-	instr.addr = &wdc65c02::Addr_ZEROP;
-	instr.code = &wdc65c02::Op_LDA;
-	instr.cycles = 3;
-	InstrTable[0xA5] = instr;
-	instr.addr = &wdc65c02::Addr_ZPIXN;
-	instr.code = &wdc65c02::Op_LDA;
-	instr.cycles = 6;
-	InstrTable[0xA1] = instr;
-	instr.addr = &wdc65c02::Addr_ZRPIX;
-	instr.code = &wdc65c02::Op_LDA;
-	instr.cycles = 4;
-	InstrTable[0xB5] = instr;
-	instr.addr = &wdc65c02::Addr_ZRPIN;
-	instr.code = &wdc65c02::Op_LDA;
-	instr.cycles = 5;
-	InstrTable[0xB2] = instr; // New adressing mode
-	instr.addr = &wdc65c02::Addr_ZPINY;
-	instr.code = &wdc65c02::Op_LDA;
-	instr.cycles = 5;
-	InstrTable[0xB1] = instr;
-
-	instr.addr = &wdc65c02::Addr_ABSOL;
-	instr.code = &wdc65c02::Op_LDX;
-	instr.cycles = 4;
-	InstrTable[0xAE] = instr;
-	instr.addr = &wdc65c02::Addr_ABSIY;
-	instr.code = &wdc65c02::Op_LDX;
-	instr.cycles = 4;
-	InstrTable[0xBE] = instr;
-	instr.addr = &wdc65c02::Addr_IMMED;
-	instr.code = &wdc65c02::Op_LDX;
-	instr.cycles = 2;
-	InstrTable[0xA2] = instr;
-	instr.addr = &wdc65c02::Addr_ZEROP;
-	instr.code = &wdc65c02::Op_LDX;
-	instr.cycles = 3;
-	InstrTable[0xA6] = instr;
-	instr.addr = &wdc65c02::Addr_ZRPIY;
-	instr.code = &wdc65c02::Op_LDX;
-	instr.cycles = 4;
-	InstrTable[0xB6] = instr;
-
-	instr.addr = &wdc65c02::Addr_ABSOL;
-	instr.code = &wdc65c02::Op_LDY;
-	instr.cycles = 4;
-	InstrTable[0xAC] = instr;
-	instr.addr = &wdc65c02::Addr_ABSIX;
-	instr.code = &wdc65c02::Op_LDY;
-	instr.cycles = 4;
-	InstrTable[0xBC] = instr;
-	instr.addr = &wdc65c02::Addr_IMMED;
-	instr.code = &wdc65c02::Op_LDY;
-	instr.cycles = 2;
-	InstrTable[0xA0] = instr;
-	instr.addr = &wdc65c02::Addr_ZEROP;
-	instr.code = &wdc65c02::Op_LDY;
-	instr.cycles = 3;
-	InstrTable[0xA4] = instr;
-	instr.addr = &wdc65c02::Addr_ZRPIX;
-	instr.code = &wdc65c02::Op_LDY;
-	instr.cycles = 4;
-	InstrTable[0xB4] = instr;
-
-	instr.addr = &wdc65c02::Addr_ABSOL;
-	instr.code = &wdc65c02::Op_LSR;
-	instr.cycles = 6;
-	InstrTable[0x4E] = instr;
-	instr.addr = &wdc65c02::Addr_ABSIX;
-	instr.code = &wdc65c02::Op_LSR;
-	instr.cycles = 7;
-	InstrTable[0x5E] = instr;
-	instr.addr = &wdc65c02::Addr_ACCUM;
-	instr.code = &wdc65c02::Op_LSR_ACC;
-	instr.cycles = 2;
-	InstrTable[0x4A] = instr;
-	instr.addr = &wdc65c02::Addr_ZEROP;
-	instr.code = &wdc65c02::Op_LSR;
-	instr.cycles = 5;
-	InstrTable[0x46] = instr;
-	instr.addr = &wdc65c02::Addr_ZRPIX;
-	instr.code = &wdc65c02::Op_LSR;
-	instr.cycles = 6;
-	InstrTable[0x56] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_NOP;
-	instr.cycles = 2;
-	InstrTable[0xEA] = instr;
-
-	instr.addr = &wdc65c02::Addr_ABSOL;
-	instr.code = &wdc65c02::Op_ORA;
-	instr.cycles = 4;
-	InstrTable[0x0D] = instr;
-	instr.addr = &wdc65c02::Addr_ABSIX;
-	instr.code = &wdc65c02::Op_ORA;
-	instr.cycles = 4;
-	InstrTable[0x1D] = instr;
-	instr.addr = &wdc65c02::Addr_ABSIY;
-	instr.code = &wdc65c02::Op_ORA;
-	instr.cycles = 4;
-	InstrTable[0x19] = instr;
-	instr.addr = &wdc65c02::Addr_IMMED;
-	instr.code = &wdc65c02::Op_ORA;
-	instr.cycles = 2;
-	InstrTable[0x09] = instr;
-	instr.addr = &wdc65c02::Addr_ZEROP;
-	instr.code = &wdc65c02::Op_ORA;
-	instr.cycles = 3;
-	InstrTable[0x05] = instr;
-	instr.addr = &wdc65c02::Addr_ZPIXN;
-	instr.code = &wdc65c02::Op_ORA;
-	instr.cycles = 6;
-	InstrTable[0x01] = instr;
-	instr.addr = &wdc65c02::Addr_ZRPIX;
-	instr.code = &wdc65c02::Op_ORA;
-	instr.cycles = 4;
-	InstrTable[0x15] = instr;
-	instr.addr = &wdc65c02::Addr_ZRPIN;
-	instr.code = &wdc65c02::Op_ORA;
-	instr.cycles = 5;
-	InstrTable[0x12] = instr; // New adressing mode
-	instr.addr = &wdc65c02::Addr_ZPINY;
-	instr.code = &wdc65c02::Op_ORA;
-	instr.cycles = 5;
-	InstrTable[0x11] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_PHA;
-	instr.cycles = 3;
-	InstrTable[0x48] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_PHP;
-	instr.cycles = 3;
-	InstrTable[0x08] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_PHX;
-	instr.cycles = 3;
-	InstrTable[0xDA] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_PHY;
-	instr.cycles = 3;
-	InstrTable[0x5A] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_PLA;
-	instr.cycles = 4;
-	InstrTable[0x68] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_PLP;
-	instr.cycles = 4;
-	InstrTable[0x28] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_PLX;  // NEW INSTRUCTION
-	instr.cycles = 4;
-	InstrTable[0xFA] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_PLY;  // NEW INSTRUCTION
-	instr.cycles = 4;
-	InstrTable[0x7A] = instr;
-
-	// RMB (NEW INSTRUCTION)
-	instr.addr = &wdc65c02::Addr_ZEROP;
-	instr.cycles = 5;
-	instr.code = &wdc65c02::Op_RMB0;
-	InstrTable[0x07] = instr;
-	instr.code = &wdc65c02::Op_RMB1;
-	InstrTable[0x17] = instr;
-	instr.code = &wdc65c02::Op_RMB2;
-	InstrTable[0x27] = instr;
-	instr.code = &wdc65c02::Op_RMB3;
-	InstrTable[0x37] = instr;
-	instr.code = &wdc65c02::Op_RMB4;
-	InstrTable[0x47] = instr;
-	instr.code = &wdc65c02::Op_RMB5;
-	InstrTable[0x57] = instr;
-	instr.code = &wdc65c02::Op_RMB6;
-	InstrTable[0x67] = instr;
-	instr.code = &wdc65c02::Op_RMB7;
-	InstrTable[0x77] = instr;
-
-	instr.addr = &wdc65c02::Addr_ABSOL;
-	instr.code = &wdc65c02::Op_ROL;
-	instr.cycles = 6;
-	InstrTable[0x2E] = instr;
-	instr.addr = &wdc65c02::Addr_ABSIX;
-	instr.code = &wdc65c02::Op_ROL;
-	instr.cycles = 7;
-	InstrTable[0x3E] = instr;
-	instr.addr = &wdc65c02::Addr_ACCUM;
-	instr.code = &wdc65c02::Op_ROL_ACC;
-	instr.cycles = 2;
-	InstrTable[0x2A] = instr;
-	instr.addr = &wdc65c02::Addr_ZEROP;
-	instr.code = &wdc65c02::Op_ROL;
-	instr.cycles = 5;
-	InstrTable[0x26] = instr;
-	instr.addr = &wdc65c02::Addr_ZRPIX;
-	instr.code = &wdc65c02::Op_ROL;
-	instr.cycles = 6;
-	InstrTable[0x36] = instr;
-
-	instr.addr = &wdc65c02::Addr_ABSOL;
-	instr.code = &wdc65c02::Op_ROR;
-	instr.cycles = 6;
-	InstrTable[0x6E] = instr;
-	instr.addr = &wdc65c02::Addr_ABSIX;
-	instr.code = &wdc65c02::Op_ROR;
-	instr.cycles = 7;
-	InstrTable[0x7E] = instr;
-	instr.addr = &wdc65c02::Addr_ACCUM;
-	instr.code = &wdc65c02::Op_ROR_ACC;
-	instr.cycles = 2;
-	InstrTable[0x6A] = instr;
-	instr.addr = &wdc65c02::Addr_ZEROP;
-	instr.code = &wdc65c02::Op_ROR;
-	instr.cycles = 5;
-	InstrTable[0x66] = instr;
-	instr.addr = &wdc65c02::Addr_ZRPIX;
-	instr.code = &wdc65c02::Op_ROR;
-	instr.cycles = 6;
-	InstrTable[0x76] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_RTI;
-	instr.cycles = 6;
-	InstrTable[0x40] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_RTS;
-	instr.cycles = 6;
-	InstrTable[0x60] = instr;
-
-	instr.addr = &wdc65c02::Addr_ABSOL;
-	instr.code = &wdc65c02::Op_SBC;
-	instr.cycles = 4;
-	InstrTable[0xED] = instr;
-	instr.addr = &wdc65c02::Addr_ABSIX;
-	instr.code = &wdc65c02::Op_SBC;
-	instr.cycles = 4;
-	InstrTable[0xFD] = instr;
-	instr.addr = &wdc65c02::Addr_ABSIY;
-	instr.code = &wdc65c02::Op_SBC;
-	instr.cycles = 4;
-	InstrTable[0xF9] = instr;
-	instr.addr = &wdc65c02::Addr_IMMED;
-	instr.code = &wdc65c02::Op_SBC;
-	instr.cycles = 2;
-	InstrTable[0xE9] = instr;
-	instr.addr = &wdc65c02::Addr_ZEROP;
-	instr.code = &wdc65c02::Op_SBC;
-	instr.cycles = 3;
-	InstrTable[0xE5] = instr;
-	instr.addr = &wdc65c02::Addr_ZPIXN;
-	instr.code = &wdc65c02::Op_SBC;
-	instr.cycles = 6;
-	InstrTable[0xE1] = instr;
-	instr.addr = &wdc65c02::Addr_ZRPIX;
-	instr.code = &wdc65c02::Op_SBC;
-	instr.cycles = 4;
-	InstrTable[0xF5] = instr;
-	instr.addr = &wdc65c02::Addr_ZRPIN;
-	instr.code = &wdc65c02::Op_SBC;
-	instr.cycles = 5;
-	InstrTable[0xF2] = instr;
-	instr.addr = &wdc65c02::Addr_ZPINY;
-	instr.code = &wdc65c02::Op_SBC;
-	instr.cycles = 5;
-	InstrTable[0xF1] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_SEC;
-	instr.cycles = 2;
-	InstrTable[0x38] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_SED;
-	instr.cycles = 2;
-	InstrTable[0xF8] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_SEI;
-	instr.cycles = 2;
-	InstrTable[0x78] = instr;
-
-	// SMB (NEW INSTRUCTION)
-	instr.addr = &wdc65c02::Addr_ZEROP;
-	instr.cycles = 5;
-	instr.code = &wdc65c02::Op_SMB0;
-	InstrTable[0x87] = instr;
-	instr.code = &wdc65c02::Op_SMB1;
-	InstrTable[0x97] = instr;
-	instr.code = &wdc65c02::Op_SMB2;
-	InstrTable[0xA7] = instr;
-	instr.code = &wdc65c02::Op_SMB3;
-	InstrTable[0xB7] = instr;
-	instr.code = &wdc65c02::Op_SMB4;
-	InstrTable[0xC7] = instr;
-	instr.code = &wdc65c02::Op_SMB5;
-	InstrTable[0xD7] = instr;
-	instr.code = &wdc65c02::Op_SMB6;
-	InstrTable[0xE7] = instr;
-	instr.code = &wdc65c02::Op_SMB7;
-	InstrTable[0xF7] = instr;
-
-	instr.addr = &wdc65c02::Addr_ABSOL;
-	instr.code = &wdc65c02::Op_STA;
-	instr.cycles = 4;
-	InstrTable[0x8D] = instr;
-	instr.addr = &wdc65c02::Addr_ABSIX;
-	instr.code = &wdc65c02::Op_STA;
-	instr.cycles = 6;
-	InstrTable[0x9D] = instr;
-	instr.addr = &wdc65c02::Addr_ABSIY;
-	instr.code = &wdc65c02::Op_STA;
-	instr.cycles = 5;
-	InstrTable[0x99] = instr;
-	instr.addr = &wdc65c02::Addr_ZEROP;
-	instr.code = &wdc65c02::Op_STA;
-	instr.cycles = 3;
-	InstrTable[0x85] = instr;
-	instr.addr = &wdc65c02::Addr_ZPIXN;
-	instr.code = &wdc65c02::Op_STA;
-	instr.cycles = 6;
-	InstrTable[0x81] = instr;
-	instr.addr = &wdc65c02::Addr_ZRPIX;
-	instr.code = &wdc65c02::Op_STA;
-	instr.cycles = 4;
-	InstrTable[0x95] = instr;
-	instr.addr = &wdc65c02::Addr_ZRPIN;
-	instr.code = &wdc65c02::Op_STA;
-	instr.cycles = 6;
-	InstrTable[0x92] = instr; // New adressing mode
-	instr.addr = &wdc65c02::Addr_ZPINY;
-	instr.code = &wdc65c02::Op_STA;
-	instr.cycles = 6;
-	InstrTable[0x91] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_STP;  // NEW INSTRUCTION
-	instr.cycles = 2;
-	InstrTable[0xDB] = instr;
-
-	instr.addr = &wdc65c02::Addr_ABSOL;
-	instr.code = &wdc65c02::Op_STX;
-	instr.cycles = 4;
-	InstrTable[0x8E] = instr;
-	instr.addr = &wdc65c02::Addr_ZEROP;
-	instr.code = &wdc65c02::Op_STX;
-	instr.cycles = 3;
-	InstrTable[0x86] = instr;
-	instr.addr = &wdc65c02::Addr_ZRPIY;
-	instr.code = &wdc65c02::Op_STX;
-	instr.cycles = 4;
-	InstrTable[0x96] = instr;
-
-	instr.addr = &wdc65c02::Addr_ABSOL;
-	instr.code = &wdc65c02::Op_STY;
-	instr.cycles = 4;
-	InstrTable[0x8C] = instr;
-	instr.addr = &wdc65c02::Addr_ZEROP;
-	instr.code = &wdc65c02::Op_STY;
-	instr.cycles = 3;
-	InstrTable[0x84] = instr;
-	instr.addr = &wdc65c02::Addr_ZRPIX;
-	instr.code = &wdc65c02::Op_STY;
-	instr.cycles = 4;
-	InstrTable[0x94] = instr;
-
-	instr.addr = &wdc65c02::Addr_ABSOL;
-	instr.code = &wdc65c02::Op_STZ;  // NEW INSTRUCTION
-	instr.cycles = 5;
-	InstrTable[0x9C] = instr;
-	instr.addr = &wdc65c02::Addr_ABSIX;
-	instr.code = &wdc65c02::Op_STZ;
-	instr.cycles = 6;
-	InstrTable[0x9E] = instr;
-	instr.addr = &wdc65c02::Addr_ZEROP;
-	instr.code = &wdc65c02::Op_STZ;
-	instr.cycles = 4;
-	InstrTable[0x64] = instr;
-	instr.addr = &wdc65c02::Addr_ZRPIX;
-	instr.code = &wdc65c02::Op_STZ;
-	instr.cycles = 5;
-	InstrTable[0x74] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_TAX;
-	instr.cycles = 2;
-	InstrTable[0xAA] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_TAY;
-	instr.cycles = 2;
-	InstrTable[0xA8] = instr;
-
-	instr.addr = &wdc65c02::Addr_ABSOL;
-	instr.code = &wdc65c02::Op_TRB;  // NEW INSTRUCTION
-	instr.cycles = 6;
-	InstrTable[0x1C] = instr;
-	instr.addr = &wdc65c02::Addr_ZEROP;
-	instr.code = &wdc65c02::Op_TRB;
-	instr.cycles = 5;
-	InstrTable[0x14] = instr;
-
-	instr.addr = &wdc65c02::Addr_ABSOL;
-	instr.code = &wdc65c02::Op_TSB;  // NEW INSTRUCTION
-	instr.cycles = 6;
-	InstrTable[0x0C] = instr;
-	instr.addr = &wdc65c02::Addr_ZEROP;
-	instr.code = &wdc65c02::Op_TSB;
-	instr.cycles = 5;
-	InstrTable[0x04] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_TSX;
-	instr.cycles = 2;
-	InstrTable[0xBA] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_TXA;
-	instr.cycles = 2;
-	InstrTable[0x8A] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_TXS;
-	instr.cycles = 2;
-	InstrTable[0x9A] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_TYA;
-	instr.cycles = 2;
-	InstrTable[0x98] = instr;
-
-	instr.addr = &wdc65c02::Addr_IMPLI;
-	instr.code = &wdc65c02::Op_WAI;  // NEW INSTRUCTION
-	instr.cycles = 5;
-	InstrTable[0xCB] = instr;
-
-	return;
+	, dispatch(TABLE_DISPATCH)
+	, idleSkip(0)
+	, idleCycles(0)
+	, busReads(0)
+	, busReadCtx(NULL)
+	, busWriteCtx(NULL)
+	, busContext(NULL)
+{
+	busWrite = (BusWrite)w;
+	busRead = (BusRead)r;
+
+	irqLines = 0;
+	nmiLine = 0;
+	nmiLatch = 0;
+	traceLines = 0;
+	memset(ownedPage, 0, sizeof(ownedPage));
+	memset(pageFlags, 0, sizeof(pageFlags));
+	blocks = NULL;
+	blockEpoch = 0;
+	traces = NULL;
+	profile = NULL;
+	calls = NULL;
+	tracer = NULL;
+	events = NULL;
+	stats = NULL;
+#ifdef WDC65C02_STATS
+	stats = new Stats();
+#endif
+	MapBus(0x0000, 0x10000);
+}
+
+// The context is passed back as the first argument of every callback, so
+// several differently wired CPUs can share the same callback functions.
+wdc65c02::wdc65c02(BusReadCtx r, BusWriteCtx w, void* context)
+	: reset_A(0x00)
+    , reset_X(0x00)
+    , reset_Y(0x00)
+    , reset_sp(0xFD)
+    , reset_status(CONSTANT)
+	, STOP(0x00)
+	, dispatch(TABLE_DISPATCH)
+	, idleSkip(0)
+	, idleCycles(0)
+	, busReads(0)
+	, busRead(NULL)
+	, busWrite(NULL)
+	, busContext(context)
+{
+	busWriteCtx = (BusWriteCtx)w;
+	busReadCtx = (BusReadCtx)r;
+
+	irqLines = 0;
+	nmiLine = 0;
+	nmiLatch = 0;
+	traceLines = 0;
+	memset(ownedPage, 0, sizeof(ownedPage));
+	memset(pageFlags, 0, sizeof(pageFlags));
+	blocks = NULL;
+	blockEpoch = 0;
+	traces = NULL;
+	profile = NULL;
+	calls = NULL;
+	tracer = NULL;
+	events = NULL;
+	stats = NULL;
+#ifdef WDC65C02_STATS
+	stats = new Stats();
+#endif
+	MapBus(0x0000, 0x10000);
+}
+
+wdc65c02::~wdc65c02()
+{
+	for (int i = 0; i < 256; i++)
+	{
+		ReleasePage(i);
+	}
+	delete[] blocks;
+	delete[] traces;
+	delete profile;
+	delete calls;
+	delete tracer;
+	delete stats;
+	delete events;
 }
 
 
@@ -975,99 +797,2473 @@ void wdc65c02::Reset()
 
 	sp = reset_sp;
 
-	status = reset_status | CONSTANT | BREAK;
+	LoadStatus(reset_status | CONSTANT | BREAK);
+
+	// the interrupt inputs are still driven by the devices
+	nmiLatch = 0;
+	CheckInterrupts();
+
+	return;
+}
+
+uint8_t wdc65c02::Read(uint16_t address)
+{
+	const uint8_t* page = readPage[address >> 8];
+	if (page) return page[address & 0xFF];
+	busReads++;
+	if (busReadCtx) return busReadCtx(busContext, address);
+	return busRead(address);
+}
+
+void wdc65c02::Write(uint16_t address, uint8_t value)
+{
+	uint8_t* page = writePage[address >> 8];
+	if (!page && pageFlags[address >> 8]) page = WriteTrap(address >> 8);
+	if (page) page[address & 0xFF] = value;
+	else if (busWriteCtx) busWriteCtx(busContext, address, value);
+	else busWrite(address, value);
+}
+
+void wdc65c02::StackPush(uint8_t byte)
+{
+	Write(0x0100 + sp, byte);
+	if(sp == 0x00) sp = 0xFF;
+	else sp--;
+}
+
+uint8_t wdc65c02::StackPop()
+{
+	if(sp == 0xFF) sp = 0x00;
+	else sp++;
+	return Read(0x0100 + sp);
+}
+
+// With WDC65C02_LAZY_FLAGS the N and Z bits of status are stale, these
+// are used wherever the register is read or written as a whole.
+uint8_t wdc65c02::SyncStatus()
+{
+#ifdef WDC65C02_LAZY_FLAGS
+	status = (status & ~(NEGATIVE | ZERO)) | (nValue & NEGATIVE) | (zValue ? 0 : ZERO);
+#endif
+	return status;
+}
+
+void wdc65c02::LoadStatus(uint8_t value)
+{
+	status = value;
+	nValue = value & NEGATIVE;
+	zValue = !(value & ZERO);
+	return;
+}
+
+void wdc65c02::IRQ()
+{
+	if (STOP & 0b01) return;
+	if (STOP & 0b10) {
+		STOP &= 0b11111101;
+		pc++;
+	}
+	if(!IF_INTERRUPT())
+	{
+		STATS_EVENT(irqs);
+		//SET_BREAK(0);
+		StackPush((pc >> 8) & 0xFF);
+		StackPush(pc & 0xFF);
+		StackPush((SyncStatus() & ~BREAK) | CONSTANT);
+		SET_INTERRUPT(1);
+		SET_DECIMAL(0);
+		TRACE_INTERRUPT(TRACE_IRQ);
+
+		// load PC from irq vector
+		uint8_t pcl = Read(irqVectorL);
+		uint8_t pch = Read(irqVectorH);
+		pc = (pch << 8) + pcl;
+		CALLS_INTERRUPT();
+	}
+	return;
+}
+
+void wdc65c02::NMI()
+{
+	if (STOP & 0b01) return;
+	if (STOP & 0b10) {
+		STOP &= 0b11111101;
+		pc++;
+	}
+	STATS_EVENT(nmis);
+	//SET_BREAK(0);
+	StackPush((pc >> 8) & 0xFF);
+	StackPush(pc & 0xFF);
+	StackPush((SyncStatus() & ~BREAK) | CONSTANT);
+	SET_INTERRUPT(1);
+	SET_DECIMAL(0);
+	TRACE_INTERRUPT(TRACE_NMI);
+
+	// load PC from NMI vector
+	uint8_t pcl = Read(nmiVectorL);
+	uint8_t pch = Read(nmiVectorH);
+	pc = (pch << 8) + pcl;
+	CALLS_INTERRUPT();
+	return;
+}
+
+// Interrupt inputs. IRQ is level triggered and wired-OR: every source has
+// a bit, and the line is asserted while any of them is. NMI is edge
+// triggered, asserting the line latches one NMI. Unlike IRQ() and NMI(),
+// which act at once, the inputs are sampled by Run() at the next
+// instruction boundary. A pending IRQ is taken when the I flag is clear
+// (e.g. right after CLI), and wakes the processor from WAI either way.
+//
+// The lines may be set from any thread, also while another one is inside
+// Run(). They only touch atomics: asserting a line sets the STOP bit that
+// the dispatch loops test anyway, and the running thread looks at the
+// registers in TakeInterrupts(). While tracing, releasing a line also
+// ends the slice, so the trace sees it go down before it comes up again;
+// that is known from traceLines, as tracer belongs to the running thread.
+void wdc65c02::SetIRQLine(uint32_t sources, bool asserted)
+{
+	if (asserted)
+	{
+		irqLines |= sources;
+		STOP |= 0b00000100;
+	}
+	else
+	{
+		irqLines &= ~sources;
+		TRACE_RELEASE();
+	}
+}
+
+uint32_t wdc65c02::GetIRQLines()
+{
+	return irqLines;
+}
+
+void wdc65c02::SetNMILine(bool asserted)
+{
+	if (!asserted)
+	{
+		nmiLine = 0;
+		TRACE_RELEASE();
+	}
+	else if (!nmiLine.exchange(1))
+	{
+		nmiLatch = 1;
+		STOP |= 0b00000100;
+	}
+}
+
+bool wdc65c02::GetNMILine()
+{
+	return nmiLine != 0;
+}
+
+// True if Run() takes an interrupt, or leaves WAI, at the next instruction
+// boundary. GetSTOP() only has the STP and WAI bits.
+bool wdc65c02::GetPendingInterrupt()
+{
+	return (STOP & 0b100) != 0;
+}
+
+// Flags an interrupt to take at the next instruction boundary. Setting a
+// STOP bit makes the dispatch loops return to Run(), so they don't need a
+// check of their own. Asserting a line sets the bit directly; this covers
+// the cases where a line that is already held becomes takeable: Reset(),
+// LoadState(), SetP(), CLI, PLP, RTI, and WAI, which wakes on a held IRQ
+// even with I set.
+void wdc65c02::CheckInterrupts()
+{
+	if (nmiLatch || (irqLines && (!IF_INTERRUPT() || (STOP & 0b10))))
+	{
+		STOP |= 0b00000100;
+	}
+}
+
+void wdc65c02::TakeInterrupts()
+{
+	STOP &= 0b11111011;
+	if (STOP & 0b01) return;
+
+	if (nmiLatch.exchange(0))
+	{
+		NMI();
+	}
+	else if (irqLines)
+	{
+		// with I set this only wakes up from WAI
+		IRQ();
+	}
+}
+
+// Runs for the given number of cycles (or instructions, see CycleMethod),
+// stopping early on STP and WAI. The budget is split at every scheduled
+// event: the processor stops at the first instruction boundary at or past
+// the event's cycle, the event is called back, and running continues.
+void wdc65c02::Run(
+	int32_t cyclesRemaining,
+	uint64_t& cycleCount,
+	CycleMethod cycleMethod
+) {
+	for (;;)
+	{
+		if (events) FireEvents(cycleCount);
+		TRACE_LINES(cycleCount);
+		if (STOP & 0b100) TakeInterrupts();
+		if (cyclesRemaining <= 0 || (STOP & 0b01)) break;
+		if (STOP && !(idleSkip && cycleMethod == CYCLE_COUNT)) break;
+
+		// run up to the next event only
+		int32_t slice = cyclesRemaining;
+		uint64_t next = GetNextEvent();
+		if (next != UINT64_MAX)
+		{
+			uint64_t distance = next - cycleCount;
+			if (cycleMethod == INST_COUNT) distance = distance > maxInstrCycles ? distance / maxInstrCycles : 1;
+			if (distance < (uint64_t)slice) slice = (int32_t)distance;
+		}
+
+		// Waiting for an interrupt, which only an event or the host can
+		// raise: the slice passes without anything happening.
+		if (STOP)
+		{
+			cycleCount += slice;
+			idleCycles += slice;
+			cyclesRemaining -= slice;
+			continue;
+		}
+
+		int32_t later = cyclesRemaining - slice;
+		cyclesRemaining = slice;
+		RunLoop(cyclesRemaining, cycleCount, cycleMethod);
+		cyclesRemaining += later;
+	}
+}
+
+void wdc65c02::RunLoop(
+	int32_t& cyclesRemaining,
+	uint64_t& cycleCount,
+	CycleMethod cycleMethod
+) {
+	uint8_t opcode;
+	Instr instr;
+
+#ifndef WDC65C02_NO_PROFILE
+	if (profile || (calls && !calls->period) || tracer)
+	{
+		RunProfiled(cyclesRemaining, cycleCount, cycleMethod);
+		return;
+	}
+#endif
+
+#ifdef WDC65C02_BLOCKS
+	if (dispatch == BLOCK_DISPATCH || dispatch == TRACE_DISPATCH)
+	{
+		RunBlocks(cyclesRemaining, cycleCount, cycleMethod);
+		return;
+	}
+#endif
+
+	if (dispatch == SWITCH_DISPATCH)
+	{
+		uint8_t cycles;
+
+		while(cyclesRemaining > 0 && !STOP)
+		{
+			// fetch
+			opcode = Read(pc++);
+			STATS_OPCODE(opcode);
+
+			// decode and execute
+			ExecSwitch(opcode);
+			cycles = InstrTable[opcode].cycles;
+			cycleCount += cycles;
+			cyclesRemaining -=
+				cycleMethod == CYCLE_COUNT        ? cycles
+				/* cycleMethod == INST_COUNT */   : 1;
+		}
+		return;
+	}
+
+	while(cyclesRemaining > 0 && !STOP)
+	{
+		// fetch
+		opcode = Read(pc++);
+		STATS_OPCODE(opcode);
+
+		// decode
+		instr = InstrTable[opcode];
+
+		// execute
+		Exec(instr);
+		cycleCount += instr.cycles;
+		cyclesRemaining -=
+			cycleMethod == CYCLE_COUNT        ? instr.cycles
+			/* cycleMethod == INST_COUNT */   : 1;
+	}
+}
+
+void wdc65c02::Exec(Instr i)
+{
+	uint16_t src = (this->*AddrTable[i.addr])();
+	(this->*CodeTable[i.code])(src);
+}
+
+// Same decode as InstrTable, but every addressing mode and operation is a
+// direct call the compiler can inline, so there is no member pointer
+// indirection left on the hot path.
+void wdc65c02::ExecSwitch(uint8_t opcode)
+{
+	switch (opcode)
+	{
+	case 0x00: Op_BRK(Addr_IMPLI()); break;
+	case 0x01: Op_ORA(Addr_ZPIXN()); break;
+	case 0x02: Op_NOP(Addr_IMMED()); break;
+	case 0x03: Op_NOP(Addr_IMPLI()); break;
+	case 0x04: Op_TSB(Addr_ZEROP()); break;
+	case 0x05: Op_ORA(Addr_ZEROP()); break;
+	case 0x06: Op_ASL(Addr_ZEROP()); break;
+	case 0x07: Op_RMB<0>(Addr_ZEROP()); break;
+	case 0x08: Op_PHP(Addr_IMPLI()); break;
+	case 0x09: Op_ORA(Addr_IMMED()); break;
+	case 0x0A: Op_ASL_ACC(Addr_ACCUM()); break;
+	case 0x0B: Op_NOP(Addr_IMPLI()); break;
+	case 0x0C: Op_TSB(Addr_ABSOL()); break;
+	case 0x0D: Op_ORA(Addr_ABSOL()); break;
+	case 0x0E: Op_ASL(Addr_ABSOL()); break;
+	case 0x0F: Op_BBR<0>(Addr_ZEROP()); break;
+	case 0x10: Op_BPL(Addr_RELAT()); break;
+	case 0x11: Op_ORA(Addr_ZPINY()); break;
+	case 0x12: Op_ORA(Addr_ZRPIN()); break;
+	case 0x13: Op_NOP(Addr_IMPLI()); break;
+	case 0x14: Op_TRB(Addr_ZEROP()); break;
+	case 0x15: Op_ORA(Addr_ZRPIX()); break;
+	case 0x16: Op_ASL(Addr_ZRPIX()); break;
+	case 0x17: Op_RMB<1>(Addr_ZEROP()); break;
+	case 0x18: Op_CLC(Addr_IMPLI()); break;
+	case 0x19: Op_ORA(Addr_ABSIY()); break;
+	case 0x1A: Op_INC_ACC(Addr_ACCUM()); break;
+	case 0x1B: Op_NOP(Addr_IMPLI()); break;
+	case 0x1C: Op_TRB(Addr_ABSOL()); break;
+	case 0x1D: Op_ORA(Addr_ABSIX()); break;
+	case 0x1E: Op_ASL(Addr_ABSIX()); break;
+	case 0x1F: Op_BBR<1>(Addr_ZEROP()); break;
+	case 0x20: Op_JSR(Addr_ABSOL()); break;
+	case 0x21: Op_AND(Addr_ZPIXN()); break;
+	case 0x22: Op_NOP(Addr_IMMED()); break;
+	case 0x23: Op_NOP(Addr_IMPLI()); break;
+	case 0x24: Op_BIT(Addr_ZEROP()); break;
+	case 0x25: Op_AND(Addr_ZEROP()); break;
+	case 0x26: Op_ROL(Addr_ZEROP()); break;
+	case 0x27: Op_RMB<2>(Addr_ZEROP()); break;
+	case 0x28: Op_PLP(Addr_IMPLI()); break;
+	case 0x29: Op_AND(Addr_IMMED()); break;
+	case 0x2A: Op_ROL_ACC(Addr_ACCUM()); break;
+	case 0x2B: Op_NOP(Addr_IMPLI()); break;
+	case 0x2C: Op_BIT(Addr_ABSOL()); break;
+	case 0x2D: Op_AND(Addr_ABSOL()); break;
+	case 0x2E: Op_ROL(Addr_ABSOL()); break;
+	case 0x2F: Op_BBR<2>(Addr_ZEROP()); break;
+	case 0x30: Op_BMI(Addr_RELAT()); break;
+	case 0x31: Op_AND(Addr_ZPINY()); break;
+	case 0x32: Op_AND(Addr_ZRPIN()); break;
+	case 0x33: Op_NOP(Addr_IMPLI()); break;
+	case 0x34: Op_BIT(Addr_ZRPIX()); break;
+	case 0x35: Op_AND(Addr_ZRPIX()); break;
+	case 0x36: Op_ROL(Addr_ZRPIX()); break;
+	case 0x37: Op_RMB<3>(Addr_ZEROP()); break;
+	case 0x38: Op_SEC(Addr_IMPLI()); break;
+	case 0x39: Op_AND(Addr_ABSIY()); break;
+	case 0x3A: Op_DEC_ACC(Addr_ACCUM()); break;
+	case 0x3B: Op_NOP(Addr_IMPLI()); break;
+	case 0x3C: Op_BIT(Addr_ABSIX()); break;
+	case 0x3D: Op_AND(Addr_ABSIX()); break;
+	case 0x3E: Op_ROL(Addr_ABSIX()); break;
+	case 0x3F: Op_BBR<3>(Addr_ZEROP()); break;
+	case 0x40: Op_RTI(Addr_IMPLI()); break;
+	case 0x41: Op_EOR(Addr_ZPIXN()); break;
+	case 0x42: Op_NOP(Addr_IMMED()); break;
+	case 0x43: Op_NOP(Addr_IMPLI()); break;
+	case 0x44: Op_NOP(Addr_ZEROP()); break;
+	case 0x45: Op_EOR(Addr_ZEROP()); break;
+	case 0x46: Op_LSR(Addr_ZEROP()); break;
+	case 0x47: Op_RMB<4>(Addr_ZEROP()); break;
+	case 0x48: Op_PHA(Addr_IMPLI()); break;
+	case 0x49: Op_EOR(Addr_IMMED()); break;
+	case 0x4A: Op_LSR_ACC(Addr_ACCUM()); break;
+	case 0x4B: Op_NOP(Addr_IMPLI()); break;
+	case 0x4C: Op_JMP(Addr_ABSOL()); break;
+	case 0x4D: Op_EOR(Addr_ABSOL()); break;
+	case 0x4E: Op_LSR(Addr_ABSOL()); break;
+	case 0x4F: Op_BBR<4>(Addr_ZEROP()); break;
+	case 0x50: Op_BVC(Addr_RELAT()); break;
+	case 0x51: Op_EOR(Addr_ZPINY()); break;
+	case 0x52: Op_EOR(Addr_ZRPIN()); break;
+	case 0x53: Op_NOP(Addr_IMPLI()); break;
+	case 0x54: Op_NOP(Addr_ZRPIX()); break;
+	case 0x55: Op_EOR(Addr_ZRPIX()); break;
+	case 0x56: Op_LSR(Addr_ZRPIX()); break;
+	case 0x57: Op_RMB<5>(Addr_ZEROP()); break;
+	case 0x58: Op_CLI(Addr_IMPLI()); break;
+	case 0x59: Op_EOR(Addr_ABSIY()); break;
+	case 0x5A: Op_PHY(Addr_IMPLI()); break;
+	case 0x5B: Op_NOP(Addr_IMPLI()); break;
+	case 0x5C: Op_NOP(Addr_ABSOL()); break;
+	case 0x5D: Op_EOR(Addr_ABSIX()); break;
+	case 0x5E: Op_LSR(Addr_ABSIX()); break;
+	case 0x5F: Op_BBR<5>(Addr_ZEROP()); break;
+	case 0x60: Op_RTS(Addr_IMPLI()); break;
+	case 0x61: Op_ADC(Addr_ZPIXN()); break;
+	case 0x62: Op_NOP(Addr_IMMED()); break;
+	case 0x63: Op_NOP(Addr_IMPLI()); break;
+	case 0x64: Op_STZ(Addr_ZEROP()); break;
+	case 0x65: Op_ADC(Addr_ZEROP()); break;
+	case 0x66: Op_ROR(Addr_ZEROP()); break;
+	case 0x67: Op_RMB<6>(Addr_ZEROP()); break;
+	case 0x68: Op_PLA(Addr_IMPLI()); break;
+	case 0x69: Op_ADC(Addr_IMMED()); break;
+	case 0x6A: Op_ROR_ACC(Addr_ACCUM()); break;
+	case 0x6B: Op_NOP(Addr_IMPLI()); break;
+	case 0x6C: Op_JMP(Addr_ABSIN()); break;
+	case 0x6D: Op_ADC(Addr_ABSOL()); break;
+	case 0x6E: Op_ROR(Addr_ABSOL()); break;
+	case 0x6F: Op_BBR<6>(Addr_ZEROP()); break;
+	case 0x70: Op_BVS(Addr_RELAT()); break;
+	case 0x71: Op_ADC(Addr_ZPINY()); break;
+	case 0x72: Op_ADC(Addr_ZRPIN()); break;
+	case 0x73: Op_NOP(Addr_IMPLI()); break;
+	case 0x74: Op_STZ(Addr_ZRPIX()); break;
+	case 0x75: Op_ADC(Addr_ZRPIX()); break;
+	case 0x76: Op_ROR(Addr_ZRPIX()); break;
+	case 0x77: Op_RMB<7>(Addr_ZEROP()); break;
+	case 0x78: Op_SEI(Addr_IMPLI()); break;
+	case 0x79: Op_ADC(Addr_ABSIY()); break;
+	case 0x7A: Op_PLY(Addr_IMPLI()); break;
+	case 0x7B: Op_NOP(Addr_IMPLI()); break;
+	case 0x7C: Op_JMP(Addr_ABIXN()); break;
+	case 0x7D: Op_ADC(Addr_ABSIX()); break;
+	case 0x7E: Op_ROR(Addr_ABSIX()); break;
+	case 0x7F: Op_BBR<7>(Addr_ZEROP()); break;
+	case 0x80: Op_BRA(Addr_RELAT()); break;
+	case 0x81: Op_STA(Addr_ZPIXN()); break;
+	case 0x82: Op_NOP(Addr_IMMED()); break;
+	case 0x83: Op_NOP(Addr_IMPLI()); break;
+	case 0x84: Op_STY(Addr_ZEROP()); break;
+	case 0x85: Op_STA(Addr_ZEROP()); break;
+	case 0x86: Op_STX(Addr_ZEROP()); break;
+	case 0x87: Op_SMB<0>(Addr_ZEROP()); break;
+	case 0x88: Op_DEY(Addr_IMPLI()); break;
+	case 0x89: Op_BIT_IMMED(Addr_IMMED()); break;
+	case 0x8A: Op_TXA(Addr_IMPLI()); break;
+	case 0x8B: Op_NOP(Addr_IMPLI()); break;
+	case 0x8C: Op_STY(Addr_ABSOL()); break;
+	case 0x8D: Op_STA(Addr_ABSOL()); break;
+	case 0x8E: Op_STX(Addr_ABSOL()); break;
+	case 0x8F: Op_BBS<0>(Addr_ZEROP()); break;
+	case 0x90: Op_BCC(Addr_RELAT()); break;
+	case 0x91: Op_STA(Addr_ZPINY()); break;
+	case 0x92: Op_STA(Addr_ZRPIN()); break;
+	case 0x93: Op_NOP(Addr_IMPLI()); break;
+	case 0x94: Op_STY(Addr_ZRPIX()); break;
+	case 0x95: Op_STA(Addr_ZRPIX()); break;
+	case 0x96: Op_STX(Addr_ZRPIY()); break;
+	case 0x97: Op_SMB<1>(Addr_ZEROP()); break;
+	case 0x98: Op_TYA(Addr_IMPLI()); break;
+	case 0x99: Op_STA(Addr_ABSIY()); break;
+	case 0x9A: Op_TXS(Addr_IMPLI()); break;
+	case 0x9B: Op_NOP(Addr_IMPLI()); break;
+	case 0x9C: Op_STZ(Addr_ABSOL()); break;
+	case 0x9D: Op_STA(Addr_ABSIX()); break;
+	case 0x9E: Op_STZ(Addr_ABSIX()); break;
+	case 0x9F: Op_BBS<1>(Addr_ZEROP()); break;
+	case 0xA0: Op_LDY(Addr_IMMED()); break;
+	case 0xA1: Op_LDA(Addr_ZPIXN()); break;
+	case 0xA2: Op_LDX(Addr_IMMED()); break;
+	case 0xA3: Op_NOP(Addr_IMPLI()); break;
+	case 0xA4: Op_LDY(Addr_ZEROP()); break;
+	case 0xA5: Op_LDA(Addr_ZEROP()); break;
+	case 0xA6: Op_LDX(Addr_ZEROP()); break;
+	case 0xA7: Op_SMB<2>(Addr_ZEROP()); break;
+	case 0xA8: Op_TAY(Addr_IMPLI()); break;
+	case 0xA9: Op_LDA(Addr_IMMED()); break;
+	case 0xAA: Op_TAX(Addr_IMPLI()); break;
+	case 0xAB: Op_NOP(Addr_IMPLI()); break;
+	case 0xAC: Op_LDY(Addr_ABSOL()); break;
+	case 0xAD: Op_LDA(Addr_ABSOL()); break;
+	case 0xAE: Op_LDX(Addr_ABSOL()); break;
+	case 0xAF: Op_BBS<2>(Addr_ZEROP()); break;
+	case 0xB0: Op_BCS(Addr_RELAT()); break;
+	case 0xB1: Op_LDA(Addr_ZPINY()); break;
+	case 0xB2: Op_LDA(Addr_ZRPIN()); break;
+	case 0xB3: Op_NOP(Addr_IMPLI()); break;
+	case 0xB4: Op_LDY(Addr_ZRPIX()); break;
+	case 0xB5: Op_LDA(Addr_ZRPIX()); break;
+	case 0xB6: Op_LDX(Addr_ZRPIY()); break;
+	case 0xB7: Op_SMB<3>(Addr_ZEROP()); break;
+	case 0xB8: Op_CLV(Addr_IMPLI()); break;
+	case 0xB9: Op_LDA(Addr_ABSIY()); break;
+	case 0xBA: Op_TSX(Addr_IMPLI()); break;
+	case 0xBB: Op_NOP(Addr_IMPLI()); break;
+	case 0xBC: Op_LDY(Addr_ABSIX()); break;
+	case 0xBD: Op_LDA(Addr_ABSIX()); break;
+	case 0xBE: Op_LDX(Addr_ABSIY()); break;
+	case 0xBF: Op_BBS<3>(Addr_ZEROP()); break;
+	case 0xC0: Op_CPY(Addr_IMMED()); break;
+	case 0xC1: Op_CMP(Addr_ZPIXN()); break;
+	case 0xC2: Op_NOP(Addr_IMMED()); break;
+	case 0xC3: Op_NOP(Addr_IMPLI()); break;
+	case 0xC4: Op_CPY(Addr_ZEROP()); break;
+	case 0xC5: Op_CMP(Addr_ZEROP()); break;
+	case 0xC6: Op_DEC(Addr_ZEROP()); break;
+	case 0xC7: Op_SMB<4>(Addr_ZEROP()); break;
+	case 0xC8: Op_INY(Addr_IMPLI()); break;
+	case 0xC9: Op_CMP(Addr_IMMED()); break;
+	case 0xCA: Op_DEX(Addr_IMPLI()); break;
+	case 0xCB: Op_WAI(Addr_IMPLI()); break;
+	case 0xCC: Op_CPY(Addr_ABSOL()); break;
+	case 0xCD: Op_CMP(Addr_ABSOL()); break;
+	case 0xCE: Op_DEC(Addr_ABSOL()); break;
+	case 0xCF: Op_BBS<4>(Addr_ZEROP()); break;
+	case 0xD0: Op_BNE(Addr_RELAT()); break;
+	case 0xD1: Op_CMP(Addr_ZPINY()); break;
+	case 0xD2: Op_CMP(Addr_ZRPIN()); break;
+	case 0xD3: Op_NOP(Addr_IMPLI()); break;
+	case 0xD4: Op_NOP(Addr_ZRPIX()); break;
+	case 0xD5: Op_CMP(Addr_ZRPIX()); break;
+	case 0xD6: Op_DEC(Addr_ZRPIX()); break;
+	case 0xD7: Op_SMB<5>(Addr_ZEROP()); break;
+	case 0xD8: Op_CLD(Addr_IMPLI()); break;
+	case 0xD9: Op_CMP(Addr_ABSIY()); break;
+	case 0xDA: Op_PHX(Addr_IMPLI()); break;
+	case 0xDB: Op_STP(Addr_IMPLI()); break;
+	case 0xDC: Op_NOP(Addr_ABSIX()); break;
+	case 0xDD: Op_CMP(Addr_ABSIX()); break;
+	case 0xDE: Op_DEC(Addr_ABSIX()); break;
+	case 0xDF: Op_BBS<5>(Addr_ZEROP()); break;
+	case 0xE0: Op_CPX(Addr_IMMED()); break;
+	case 0xE1: Op_SBC(Addr_ZPIXN()); break;
+	case 0xE2: Op_NOP(Addr_IMMED()); break;
+	case 0xE3: Op_NOP(Addr_IMPLI()); break;
+	case 0xE4: Op_CPX(Addr_ZEROP()); break;
+	case 0xE5: Op_SBC(Addr_ZEROP()); break;
+	case 0xE6: Op_INC(Addr_ZEROP()); break;
+	case 0xE7: Op_SMB<6>(Addr_ZEROP()); break;
+	case 0xE8: Op_INX(Addr_IMPLI()); break;
+	case 0xE9: Op_SBC(Addr_IMMED()); break;
+	case 0xEA: Op_NOP(Addr_IMPLI()); break;
+	case 0xEB: Op_NOP(Addr_IMPLI()); break;
+	case 0xEC: Op_CPX(Addr_ABSOL()); break;
+	case 0xED: Op_SBC(Addr_ABSOL()); break;
+	case 0xEE: Op_INC(Addr_ABSOL()); break;
+	case 0xEF: Op_BBS<6>(Addr_ZEROP()); break;
+	case 0xF0: Op_BEQ(Addr_RELAT()); break;
+	case 0xF1: Op_SBC(Addr_ZPINY()); break;
+	case 0xF2: Op_SBC(Addr_ZRPIN()); break;
+	case 0xF3: Op_NOP(Addr_IMPLI()); break;
+	case 0xF4: Op_NOP(Addr_ZRPIX()); break;
+	case 0xF5: Op_SBC(Addr_ZRPIX()); break;
+	case 0xF6: Op_INC(Addr_ZRPIX()); break;
+	case 0xF7: Op_SMB<7>(Addr_ZEROP()); break;
+	case 0xF8: Op_SED(Addr_IMPLI()); break;
+	case 0xF9: Op_SBC(Addr_ABSIY()); break;
+	case 0xFA: Op_PLX(Addr_IMPLI()); break;
+	case 0xFB: Op_NOP(Addr_IMPLI()); break;
+	case 0xFC: Op_NOP(Addr_ABSIX()); break;
+	case 0xFD: Op_SBC(Addr_ABSIX()); break;
+	case 0xFE: Op_INC(Addr_ABSIX()); break;
+	case 0xFF: Op_BBS<7>(Addr_ZEROP()); break;
+
+	}
+}
+
+void wdc65c02::SetDispatch(DispatchMethod method)
+{
+#ifndef WDC65C02_BLOCKS
+	if (method == BLOCK_DISPATCH || method == TRACE_DISPATCH) method = SWITCH_DISPATCH;
+#endif
+	if (method != BLOCK_DISPATCH && method != TRACE_DISPATCH) FlushBlockCache();
+	dispatch = method;
+}
+
+wdc65c02::DispatchMethod wdc65c02::GetDispatch()
+{
+	return (DispatchMethod)dispatch;
+}
+
+// With idle skipping on, Run() fast-forwards over cycles in which the
+// processor can't do anything new: after WAI the rest of the budget, and
+// for BLOCK_DISPATCH or TRACE_DISPATCH, tight loops that jump back to
+// their start without writing memory or touching the callbacks, once an
+// iteration leaves every register as it was (BRA *, polling RAM). The
+// skipped cycles still count in cycleCount, and are also summed up by
+// GetIdleCycles().
+void wdc65c02::SetIdleSkip(bool enable)
+{
+	idleSkip = enable;
+}
+
+bool wdc65c02::GetIdleSkip()
+{
+	return idleSkip != 0;
+}
+
+uint64_t wdc65c02::GetIdleCycles()
+{
+	return idleCycles;
+}
+
+uint8_t wdc65c02::InstrLength(uint8_t opcode)
+{
+	uint8_t addr = InstrTable[opcode].addr;
+
+	// BBR and BBS read their branch offset after the zero page address
+	if ((opcode & 0x0F) == 0x0F) return 3;
+
+	if (addr == MODE_IMPLI || addr == MODE_ACCUM) return 1;
+	if (addr == MODE_ABSOL || addr == MODE_ABIXN ||
+		addr == MODE_ABSIX || addr == MODE_ABSIY ||
+		addr == MODE_ABSIN) return 3;
+	return 2;
+}
+
+wdc65c02::AddressingMode wdc65c02::InstrMode(uint8_t opcode)
+{
+	return (AddressingMode)InstrTable[opcode].addr;
+}
+
+uint8_t wdc65c02::InstrCycles(uint8_t opcode)
+{
+	return InstrTable[opcode].cycles;
+}
+
+// Instructions that write memory, including the stack.
+bool wdc65c02::InstrWrites(uint8_t opcode)
+{
+	uint8_t code = InstrTable[opcode].code;
+
+	if ((opcode & 0x0F) == 0x07) return true; // RMB, SMB
+
+	return code == OP_STA || code == OP_STX ||
+		code == OP_STY || code == OP_STZ ||
+		code == OP_INC || code == OP_DEC ||
+		code == OP_ASL || code == OP_LSR ||
+		code == OP_ROL || code == OP_ROR ||
+		code == OP_TSB || code == OP_TRB ||
+		code == OP_PHA || code == OP_PHX ||
+		code == OP_PHY || code == OP_PHP ||
+		code == OP_JSR || code == OP_BRK;
+}
+
+
+// BLOCK CACHE
+
+#ifdef WDC65C02_BLOCKS
+// Straight-line code is decoded once into a block that starts at pc and
+// ends after a control transfer (or blockLength instructions). Running a
+// block skips the opcode fetch and decode of each instruction; operands
+// are still read at run time. Pages holding blocks lose their direct
+// write pointer, so the first write to such a page goes through
+// WriteTrap() and drops the blocks before memory changes.
+void wdc65c02::RunBlocks(
+	int32_t& cyclesRemaining,
+	uint64_t& cycleCount,
+	CycleMethod cycleMethod
+) {
+	uint8_t opcode;
+	uint8_t cycles;
+	bool tracing = dispatch == TRACE_DISPATCH;
+
+	if (!blocks) blocks = new Block[blockCount]();
+	if (tracing && !traces) traces = new Trace[traceCount]();
+
+	while(cyclesRemaining > 0 && !STOP)
+	{
+		if (tracing)
+		{
+			Trace* trace = &traces[pc & (traceCount - 1)];
+
+			if (trace->count && trace->pc == pc &&
+				(cycleMethod == CYCLE_COUNT ? trace->cycles : trace->count) <= cyclesRemaining)
+			{
+				bool idle = idleSkip && trace->idle;
+				uint64_t state = idle ? IdleState() : 0;
+
+				uint32_t epoch = blockEpoch;
+				uint8_t i = 0;
+				for (;;)
+				{
+					uint8_t end = i + 1;
+					if (trace->instr[i].fused)
+					{
+						end = i + ExecFused(trace, i);
+					}
+					else
+					{
+						pc = trace->instr[i].address + trace->instr[i].length;
+						ExecResolved(trace->instr[i].opcode, trace->instr[i].operand);
+					}
+
+					// counted one instruction at a time, fused or not
+					do
+					{
+						STATS_OPCODE(trace->instr[i].opcode);
+						cycles = trace->instr[i].cycles;
+						cycleCount += cycles;
+						cyclesRemaining -=
+							cycleMethod == CYCLE_COUNT        ? cycles
+							/* cycleMethod == INST_COUNT */   : 1;
+					} while (++i < end);
+
+					if (epoch != blockEpoch || STOP || i == trace->count) break;
+
+					// a branch went the other way than when the trace was built
+					if (pc != trace->instr[i].address) break;
+				}
+
+				if (idle && i == trace->count && epoch == blockEpoch && pc == trace->pc &&
+					state == IdleState())
+				{
+					SkipIdle(cyclesRemaining, cycleCount, cycleMethod, trace->cycles, trace->count);
+				}
+				continue;
+			}
+		}
+
+		Block* block = GetBlock(pc);
+
+		// not in RAM or ROM, or not enough cycles left for the whole block:
+		// run a single instruction so Run() stops at the same place
+		if (!block || (cycleMethod == CYCLE_COUNT ? block->cycles : block->count) > cyclesRemaining)
+		{
+			opcode = Read(pc++);
+			STATS_OPCODE(opcode);
+			ExecSwitch(opcode);
+			cycles = InstrTable[opcode].cycles;
+			cycleCount += cycles;
+			cyclesRemaining -=
+				cycleMethod == CYCLE_COUNT        ? cycles
+				/* cycleMethod == INST_COUNT */   : 1;
+			continue;
+		}
+
+		bool idle = idleSkip && block->idle;
+		uint64_t state = idle ? IdleState() : 0;
+
+		uint32_t epoch = blockEpoch;
+		for (uint8_t i = 0; i < block->count; i++)
+		{
+			pc++;
+			ExecSwitch(block->instr[i].opcode);
+			STATS_OPCODE(block->instr[i].opcode);
+			cycles = block->instr[i].cycles;
+			cycleCount += cycles;
+			cyclesRemaining -=
+				cycleMethod == CYCLE_COUNT        ? cycles
+				/* cycleMethod == INST_COUNT */   : 1;
+
+			// the instruction wrote to a code page, the block may be stale,
+			// or there is an interrupt to take
+			if (epoch != blockEpoch || STOP) break;
+		}
+
+		if (idle && epoch == blockEpoch && pc == block->pc && state == IdleState())
+		{
+			SkipIdle(cyclesRemaining, cycleCount, cycleMethod, block->cycles, block->count);
+			continue;
+		}
+
+		if (tracing && !idle && epoch == blockEpoch && ++block->hits == hotThreshold)
+		{
+			BuildTrace(block->pc);
+		}
+	}
+}
+
+// Returns the block starting at address, decoding it if needed, or NULL
+// if the first instruction is not in RAM or ROM.
+wdc65c02::Block* wdc65c02::GetBlock(uint16_t address)
+{
+	Block* block = &blocks[address & (blockCount - 1)];
+
+	if (block->count && block->pc == address) return block;
+
+	block->pc = address;
+	block->cycles = 0;
+	block->hits = 0;
+	block->count = 0;
+	block->idle = 0;
+
+	bool writes = false;
+
+	while (block->count < blockLength)
+	{
+		// decode from mapped memory only, reading I/O could have side effects
+		const uint8_t* page = readPage[address >> 8];
+		if (!page) break;
+
+		uint8_t opcode = page[address & 0xFF];
+		uint16_t last = address + InstrLength(opcode) - 1;
+		if (!readPage[last >> 8]) break;
+
+		block->instr[block->count].opcode = opcode;
+		block->instr[block->count].cycles = InstrTable[opcode].cycles;
+		block->cycles += InstrTable[opcode].cycles;
+		block->count++;
+
+		pageFlags[address >> 8] |= PAGE_CODE;
+		pageFlags[last >> 8] |= PAGE_CODE;
+		writePage[address >> 8] = NULL;
+		writePage[last >> 8] = NULL;
+
+		if (InstrWrites(opcode)) writes = true;
+
+		address = last + 1;
+		if (InstrEndsBlock(opcode))
+		{
+			// BRA, JMP, branch or BBR/BBS back to the start of the block
+			uint8_t offset = readPage[last >> 8][last & 0xFF];
+			uint16_t target = address + (int8_t)offset;
+			bool jump = InstrTable[opcode].addr == MODE_RELAT || (opcode & 0x0F) == 0x0F;
+			if (opcode == 0x4C)
+			{
+				target = (offset << 8) | readPage[(uint16_t)(last - 1) >> 8][(last - 1) & 0xFF];
+				jump = true;
+			}
+			block->idle = jump && !writes && target == block->pc;
+			break;
+		}
+	}
+
+	block->end = address;
+	return block->count ? block : NULL;
+}
+#endif
+
+// Drops every block with code on the page and gives the page its direct
+// write pointer back.
+void wdc65c02::InvalidatePage(uint8_t page)
+{
+	for (int i = 0; i < blockCount; i++)
+	{
+		Block* block = &blocks[i];
+
+		if (!block->count) continue;
+		if ((block->pc >> 8) == page || ((uint16_t)(block->end - 1) >> 8) == page)
+		{
+			block->count = 0;
+		}
+	}
+
+	// traces span many pages, drop them all
+	for (int i = 0; traces && i < traceCount; i++)
+	{
+		traces[i].count = 0;
+	}
+
+	blockEpoch++;
+	pageFlags[page] &= ~PAGE_CODE;
+	if (pageFlags[page] == PAGE_RAM) writePage[page] = (uint8_t*)readPage[page];
+}
+
+// Drops all blocks. Needed after changing RAM without going through the
+// emulator, e.g. writing to a MapRAM() buffer from the host.
+void wdc65c02::FlushBlockCache()
+{
+	for (int i = 0; i < 256; i++)
+	{
+		if (pageFlags[i] & PAGE_CODE) InvalidatePage(i);
+	}
+}
+
+#ifdef WDC65C02_BLOCKS
+// Translates the code starting at a hot block into a trace. The trace
+// follows unconditional jumps, calls and BRA, and guesses that backward
+// branches are taken (loops) and forward ones are not. It ends at the
+// first return, indirect jump, BRK, STP or WAI, when it gets back to its
+// start, or when it leaves RAM/ROM. Operands are read here once, so
+// running the trace doesn't fetch them again; see ExecResolved().
+void wdc65c02::BuildTrace(uint16_t address)
+{
+	Trace* trace = &traces[address & (traceCount - 1)];
+
+	trace->pc = address;
+	trace->cycles = 0;
+	trace->count = 0;
+	trace->idle = 0;
+
+	bool writes = false;
+
+	while (trace->count < traceLength)
+	{
+		const uint8_t* page = readPage[address >> 8];
+		if (!page) break;
+
+		uint8_t opcode = page[address & 0xFF];
+		uint8_t length = InstrLength(opcode);
+		uint16_t last = address + length - 1;
+		if (!readPage[last >> 8]) break;
+
+		uint8_t addr = InstrTable[opcode].addr;
+		uint16_t next = last + 1;
+		uint8_t lo = 0;
+		uint8_t hi = 0;
+		uint16_t operand;
+
+		if (length > 1) lo = readPage[(uint16_t)(address + 1) >> 8][(address + 1) & 0xFF];
+		if (length > 2) hi = readPage[last >> 8][last & 0xFF];
+
+		if ((opcode & 0x0F) == 0x0F) operand = address + 1; // BBR, BBS
+		else if (addr == MODE_ABSOL || addr == MODE_ABSIX ||
+			addr == MODE_ABSIY) operand = lo | (hi << 8);
+		else if (addr == MODE_ZEROP || addr == MODE_ZRPIX ||
+			addr == MODE_ZRPIY) operand = lo;
+		else if (addr == MODE_RELAT) operand = next + (int8_t)lo;
+		else if (length == 1) operand = 0;
+		else operand = address + 1; // IMMED, indirect modes
+
+		trace->instr[trace->count].opcode = opcode;
+		trace->instr[trace->count].cycles = InstrTable[opcode].cycles;
+		trace->instr[trace->count].length = length;
+		trace->instr[trace->count].fused = FUSE_NONE;
+		trace->instr[trace->count].address = address;
+		trace->instr[trace->count].operand = operand;
+		trace->cycles += InstrTable[opcode].cycles;
+		trace->count++;
+		if (InstrWrites(opcode)) writes = true;
+
+		pageFlags[address >> 8] |= PAGE_CODE;
+		pageFlags[last >> 8] |= PAGE_CODE;
+		writePage[address >> 8] = NULL;
+		writePage[last >> 8] = NULL;
+
+		if (InstrEndsBlock(opcode))
+		{
+			if (opcode == 0x4C || opcode == 0x20 || opcode == 0x80)
+			{
+				next = operand; // JMP, JSR, BRA
+			}
+			else if (addr == MODE_RELAT)
+			{
+				if (operand <= address) next = operand;
+			}
+			else if ((opcode & 0x0F) == 0x0F)
+			{
+				uint16_t target = next + (int8_t)hi;
+				if (target <= address) next = target;
+			}
+			else break;
+		}
+
+		address = next;
+		if (address == trace->pc)
+		{
+			trace->idle = !writes;
+			break;
+		}
+	}
+
+	FuseTrace(trace);
+}
+
+// Marks the sequences of a trace that ExecFused() can run in one go.
+void wdc65c02::FuseTrace(Trace* trace)
+{
+	for (int i = 0; i < trace->count; i++)
+	{
+		int a = trace->instr[i].opcode;
+		int b = i + 1 < trace->count ? trace->instr[i + 1].opcode : -1;
+		int c = i + 2 < trace->count ? trace->instr[i + 2].opcode : -1;
+		uint8_t fused = FUSE_NONE;
+		int length = 2;
+
+		if ((a == 0xA9 || a == 0xA5 || a == 0xAD) && (b == 0x85 || b == 0x8D)) fused = FUSE_LDA_STA;
+		else if (a == 0xBD && b == 0x9D) fused = FUSE_LDA_STA_X;
+		else if (a == 0xB9 && b == 0x99) fused = FUSE_LDA_STA_Y;
+		else if (a == 0xCA && b == 0xD0) fused = FUSE_DEX_BNE;
+		else if (a == 0x88 && b == 0xD0) fused = FUSE_DEY_BNE;
+		else if (a == 0xE8 && (b == 0xE0 || b == 0xE4 || b == 0xEC) && c == 0xD0)
+		{
+			fused = FUSE_INX_CPX_BNE;
+			length = 3;
+		}
+		else if (a == 0xC8 && (b == 0xC0 || b == 0xC4 || b == 0xCC) && c == 0xD0)
+		{
+			fused = FUSE_INY_CPY_BNE;
+			length = 3;
+		}
+		else if (a == 0xC9 || a == 0xC5 || a == 0xCD)
+		{
+			if (b == 0xF0) fused = FUSE_CMP_BEQ;
+			else if (b == 0xD0) fused = FUSE_CMP_BNE;
+			else if (b == 0x90) fused = FUSE_CMP_BCC;
+			else if (b == 0xB0) fused = FUSE_CMP_BCS;
+		}
+
+		FUSED_PROFILE_MATCH
+
+		if (fused)
+		{
+			trace->instr[i].fused = fused;
+			i += length - 1;
+		}
+	}
+}
+
+// Runs a fused sequence of a trace starting at instruction i, returns the
+// number of instructions it covers. Registers, flags and memory end up the
+// same as when running them one at a time; the last instruction of a
+// sequence is the only one that can write memory or branch.
+uint8_t wdc65c02::ExecFused(const Trace* trace, uint8_t i)
+{
+	uint16_t a = trace->instr[i].operand;
+	uint16_t b = trace->instr[i + 1].operand;
+
+	switch (trace->instr[i].fused)
+	{
+	case FUSE_LDA_STA:
+		pc = trace->instr[i + 1].address + trace->instr[i + 1].length;
+		Op_LDA(a);
+		Op_STA(b);
+		return 2;
+	case FUSE_LDA_STA_X:
+		pc = trace->instr[i + 1].address + 3;
+		Op_LDA(a + X);
+		Op_STA(b + X);
+		return 2;
+	case FUSE_LDA_STA_Y:
+		pc = trace->instr[i + 1].address + 3;
+		Op_LDA(a + Y);
+		Op_STA(b + Y);
+		return 2;
+	case FUSE_DEX_BNE:
+		pc = trace->instr[i + 1].address + 2;
+		Op_DEX(0);
+		if (X) pc = b;
+		return 2;
+	case FUSE_DEY_BNE:
+		pc = trace->instr[i + 1].address + 2;
+		Op_DEY(0);
+		if (Y) pc = b;
+		return 2;
+	case FUSE_INX_CPX_BNE:
+		pc = trace->instr[i + 2].address + 2;
+		Op_INX(0);
+		Op_CPX(b);
+		Op_BNE(trace->instr[i + 2].operand);
+		return 3;
+	case FUSE_INY_CPY_BNE:
+		pc = trace->instr[i + 2].address + 2;
+		Op_INY(0);
+		Op_CPY(b);
+		Op_BNE(trace->instr[i + 2].operand);
+		return 3;
+	case FUSE_CMP_BEQ:
+		pc = trace->instr[i + 1].address + 2;
+		Op_CMP(a);
+		Op_BEQ(b);
+		return 2;
+	case FUSE_CMP_BNE:
+		pc = trace->instr[i + 1].address + 2;
+		Op_CMP(a);
+		Op_BNE(b);
+		return 2;
+	case FUSE_CMP_BCC:
+		pc = trace->instr[i + 1].address + 2;
+		Op_CMP(a);
+		Op_BCC(b);
+		return 2;
+	case FUSE_CMP_BCS:
+		pc = trace->instr[i + 1].address + 2;
+		Op_CMP(a);
+		Op_BCS(b);
+		return 2;
+
+	FUSED_PROFILE_CASES
+	}
+	return 0;
+}
+
+// Runs an instruction of a trace, with pc already past it. The operand is
+// the effective address for absolute, zero page, immediate and relative
+// modes (indexed ones still add X or Y here). Indirect modes, BBR and BBS
+// get the address of their operand bytes and read them as usual.
+void wdc65c02::ExecResolved(uint8_t opcode, uint16_t operand)
+{
+	switch (opcode)
+	{
+	case 0x00: Op_BRK(0); break;
+	case 0x01: pc = operand; Op_ORA(Addr_ZPIXN()); break;
+	case 0x02: Op_NOP(operand); break;
+	case 0x03: Op_NOP(0); break;
+	case 0x04: Op_TSB(operand); break;
+	case 0x05: Op_ORA(operand); break;
+	case 0x06: Op_ASL(operand); break;
+	case 0x07: Op_RMB<0>(operand); break;
+	case 0x08: Op_PHP(0); break;
+	case 0x09: Op_ORA(operand); break;
+	case 0x0A: Op_ASL_ACC(0); break;
+	case 0x0B: Op_NOP(0); break;
+	case 0x0C: Op_TSB(operand); break;
+	case 0x0D: Op_ORA(operand); break;
+	case 0x0E: Op_ASL(operand); break;
+	case 0x0F: pc = operand; Op_BBR<0>(Addr_ZEROP()); break;
+	case 0x10: Op_BPL(operand); break;
+	case 0x11: pc = operand; Op_ORA(Addr_ZPINY()); break;
+	case 0x12: pc = operand; Op_ORA(Addr_ZRPIN()); break;
+	case 0x13: Op_NOP(0); break;
+	case 0x14: Op_TRB(operand); break;
+	case 0x15: Op_ORA((operand + X) & 0xFF); break;
+	case 0x16: Op_ASL((operand + X) & 0xFF); break;
+	case 0x17: Op_RMB<1>(operand); break;
+	case 0x18: Op_CLC(0); break;
+	case 0x19: Op_ORA(operand + Y); break;
+	case 0x1A: Op_INC_ACC(0); break;
+	case 0x1B: Op_NOP(0); break;
+	case 0x1C: Op_TRB(operand); break;
+	case 0x1D: Op_ORA(operand + X); break;
+	case 0x1E: Op_ASL(operand + X); break;
+	case 0x1F: pc = operand; Op_BBR<1>(Addr_ZEROP()); break;
+	case 0x20: Op_JSR(operand); break;
+	case 0x21: pc = operand; Op_AND(Addr_ZPIXN()); break;
+	case 0x22: Op_NOP(operand); break;
+	case 0x23: Op_NOP(0); break;
+	case 0x24: Op_BIT(operand); break;
+	case 0x25: Op_AND(operand); break;
+	case 0x26: Op_ROL(operand); break;
+	case 0x27: Op_RMB<2>(operand); break;
+	case 0x28: Op_PLP(0); break;
+	case 0x29: Op_AND(operand); break;
+	case 0x2A: Op_ROL_ACC(0); break;
+	case 0x2B: Op_NOP(0); break;
+	case 0x2C: Op_BIT(operand); break;
+	case 0x2D: Op_AND(operand); break;
+	case 0x2E: Op_ROL(operand); break;
+	case 0x2F: pc = operand; Op_BBR<2>(Addr_ZEROP()); break;
+	case 0x30: Op_BMI(operand); break;
+	case 0x31: pc = operand; Op_AND(Addr_ZPINY()); break;
+	case 0x32: pc = operand; Op_AND(Addr_ZRPIN()); break;
+	case 0x33: Op_NOP(0); break;
+	case 0x34: Op_BIT((operand + X) & 0xFF); break;
+	case 0x35: Op_AND((operand + X) & 0xFF); break;
+	case 0x36: Op_ROL((operand + X) & 0xFF); break;
+	case 0x37: Op_RMB<3>(operand); break;
+	case 0x38: Op_SEC(0); break;
+	case 0x39: Op_AND(operand + Y); break;
+	case 0x3A: Op_DEC_ACC(0); break;
+	case 0x3B: Op_NOP(0); break;
+	case 0x3C: Op_BIT(operand + X); break;
+	case 0x3D: Op_AND(operand + X); break;
+	case 0x3E: Op_ROL(operand + X); break;
+	case 0x3F: pc = operand; Op_BBR<3>(Addr_ZEROP()); break;
+	case 0x40: Op_RTI(0); break;
+	case 0x41: pc = operand; Op_EOR(Addr_ZPIXN()); break;
+	case 0x42: Op_NOP(operand); break;
+	case 0x43: Op_NOP(0); break;
+	case 0x44: Op_NOP(operand); break;
+	case 0x45: Op_EOR(operand); break;
+	case 0x46: Op_LSR(operand); break;
+	case 0x47: Op_RMB<4>(operand); break;
+	case 0x48: Op_PHA(0); break;
+	case 0x49: Op_EOR(operand); break;
+	case 0x4A: Op_LSR_ACC(0); break;
+	case 0x4B: Op_NOP(0); break;
+	case 0x4C: Op_JMP(operand); break;
+	case 0x4D: Op_EOR(operand); break;
+	case 0x4E: Op_LSR(operand); break;
+	case 0x4F: pc = operand; Op_BBR<4>(Addr_ZEROP()); break;
+	case 0x50: Op_BVC(operand); break;
+	case 0x51: pc = operand; Op_EOR(Addr_ZPINY()); break;
+	case 0x52: pc = operand; Op_EOR(Addr_ZRPIN()); break;
+	case 0x53: Op_NOP(0); break;
+	case 0x54: Op_NOP((operand + X) & 0xFF); break;
+	case 0x55: Op_EOR((operand + X) & 0xFF); break;
+	case 0x56: Op_LSR((operand + X) & 0xFF); break;
+	case 0x57: Op_RMB<5>(operand); break;
+	case 0x58: Op_CLI(0); break;
+	case 0x59: Op_EOR(operand + Y); break;
+	case 0x5A: Op_PHY(0); break;
+	case 0x5B: Op_NOP(0); break;
+	case 0x5C: Op_NOP(operand); break;
+	case 0x5D: Op_EOR(operand + X); break;
+	case 0x5E: Op_LSR(operand + X); break;
+	case 0x5F: pc = operand; Op_BBR<5>(Addr_ZEROP()); break;
+	case 0x60: Op_RTS(0); break;
+	case 0x61: pc = operand; Op_ADC(Addr_ZPIXN()); break;
+	case 0x62: Op_NOP(operand); break;
+	case 0x63: Op_NOP(0); break;
+	case 0x64: Op_STZ(operand); break;
+	case 0x65: Op_ADC(operand); break;
+	case 0x66: Op_ROR(operand); break;
+	case 0x67: Op_RMB<6>(operand); break;
+	case 0x68: Op_PLA(0); break;
+	case 0x69: Op_ADC(operand); break;
+	case 0x6A: Op_ROR_ACC(0); break;
+	case 0x6B: Op_NOP(0); break;
+	case 0x6C: pc = operand; Op_JMP(Addr_ABSIN()); break;
+	case 0x6D: Op_ADC(operand); break;
+	case 0x6E: Op_ROR(operand); break;
+	case 0x6F: pc = operand; Op_BBR<6>(Addr_ZEROP()); break;
+	case 0x70: Op_BVS(operand); break;
+	case 0x71: pc = operand; Op_ADC(Addr_ZPINY()); break;
+	case 0x72: pc = operand; Op_ADC(Addr_ZRPIN()); break;
+	case 0x73: Op_NOP(0); break;
+	case 0x74: Op_STZ((operand + X) & 0xFF); break;
+	case 0x75: Op_ADC((operand + X) & 0xFF); break;
+	case 0x76: Op_ROR((operand + X) & 0xFF); break;
+	case 0x77: Op_RMB<7>(operand); break;
+	case 0x78: Op_SEI(0); break;
+	case 0x79: Op_ADC(operand + Y); break;
+	case 0x7A: Op_PLY(0); break;
+	case 0x7B: Op_NOP(0); break;
+	case 0x7C: pc = operand; Op_JMP(Addr_ABIXN()); break;
+	case 0x7D: Op_ADC(operand + X); break;
+	case 0x7E: Op_ROR(operand + X); break;
+	case 0x7F: pc = operand; Op_BBR<7>(Addr_ZEROP()); break;
+	case 0x80: Op_BRA(operand); break;
+	case 0x81: pc = operand; Op_STA(Addr_ZPIXN()); break;
+	case 0x82: Op_NOP(operand); break;
+	case 0x83: Op_NOP(0); break;
+	case 0x84: Op_STY(operand); break;
+	case 0x85: Op_STA(operand); break;
+	case 0x86: Op_STX(operand); break;
+	case 0x87: Op_SMB<0>(operand); break;
+	case 0x88: Op_DEY(0); break;
+	case 0x89: Op_BIT_IMMED(operand); break;
+	case 0x8A: Op_TXA(0); break;
+	case 0x8B: Op_NOP(0); break;
+	case 0x8C: Op_STY(operand); break;
+	case 0x8D: Op_STA(operand); break;
+	case 0x8E: Op_STX(operand); break;
+	case 0x8F: pc = operand; Op_BBS<0>(Addr_ZEROP()); break;
+	case 0x90: Op_BCC(operand); break;
+	case 0x91: pc = operand; Op_STA(Addr_ZPINY()); break;
+	case 0x92: pc = operand; Op_STA(Addr_ZRPIN()); break;
+	case 0x93: Op_NOP(0); break;
+	case 0x94: Op_STY((operand + X) & 0xFF); break;
+	case 0x95: Op_STA((operand + X) & 0xFF); break;
+	case 0x96: Op_STX((operand + Y) & 0xFF); break;
+	case 0x97: Op_SMB<1>(operand); break;
+	case 0x98: Op_TYA(0); break;
+	case 0x99: Op_STA(operand + Y); break;
+	case 0x9A: Op_TXS(0); break;
+	case 0x9B: Op_NOP(0); break;
+	case 0x9C: Op_STZ(operand); break;
+	case 0x9D: Op_STA(operand + X); break;
+	case 0x9E: Op_STZ(operand + X); break;
+	case 0x9F: pc = operand; Op_BBS<1>(Addr_ZEROP()); break;
+	case 0xA0: Op_LDY(operand); break;
+	case 0xA1: pc = operand; Op_LDA(Addr_ZPIXN()); break;
+	case 0xA2: Op_LDX(operand); break;
+	case 0xA3: Op_NOP(0); break;
+	case 0xA4: Op_LDY(operand); break;
+	case 0xA5: Op_LDA(operand); break;
+	case 0xA6: Op_LDX(operand); break;
+	case 0xA7: Op_SMB<2>(operand); break;
+	case 0xA8: Op_TAY(0); break;
+	case 0xA9: Op_LDA(operand); break;
+	case 0xAA: Op_TAX(0); break;
+	case 0xAB: Op_NOP(0); break;
+	case 0xAC: Op_LDY(operand); break;
+	case 0xAD: Op_LDA(operand); break;
+	case 0xAE: Op_LDX(operand); break;
+	case 0xAF: pc = operand; Op_BBS<2>(Addr_ZEROP()); break;
+	case 0xB0: Op_BCS(operand); break;
+	case 0xB1: pc = operand; Op_LDA(Addr_ZPINY()); break;
+	case 0xB2: pc = operand; Op_LDA(Addr_ZRPIN()); break;
+	case 0xB3: Op_NOP(0); break;
+	case 0xB4: Op_LDY((operand + X) & 0xFF); break;
+	case 0xB5: Op_LDA((operand + X) & 0xFF); break;
+	case 0xB6: Op_LDX((operand + Y) & 0xFF); break;
+	case 0xB7: Op_SMB<3>(operand); break;
+	case 0xB8: Op_CLV(0); break;
+	case 0xB9: Op_LDA(operand + Y); break;
+	case 0xBA: Op_TSX(0); break;
+	case 0xBB: Op_NOP(0); break;
+	case 0xBC: Op_LDY(operand + X); break;
+	case 0xBD: Op_LDA(operand + X); break;
+	case 0xBE: Op_LDX(operand + Y); break;
+	case 0xBF: pc = operand; Op_BBS<3>(Addr_ZEROP()); break;
+	case 0xC0: Op_CPY(operand); break;
+	case 0xC1: pc = operand; Op_CMP(Addr_ZPIXN()); break;
+	case 0xC2: Op_NOP(operand); break;
+	case 0xC3: Op_NOP(0); break;
+	case 0xC4: Op_CPY(operand); break;
+	case 0xC5: Op_CMP(operand); break;
+	case 0xC6: Op_DEC(operand); break;
+	case 0xC7: Op_SMB<4>(operand); break;
+	case 0xC8: Op_INY(0); break;
+	case 0xC9: Op_CMP(operand); break;
+	case 0xCA: Op_DEX(0); break;
+	case 0xCB: Op_WAI(0); break;
+	case 0xCC: Op_CPY(operand); break;
+	case 0xCD: Op_CMP(operand); break;
+	case 0xCE: Op_DEC(operand); break;
+	case 0xCF: pc = operand; Op_BBS<4>(Addr_ZEROP()); break;
+	case 0xD0: Op_BNE(operand); break;
+	case 0xD1: pc = operand; Op_CMP(Addr_ZPINY()); break;
+	case 0xD2: pc = operand; Op_CMP(Addr_ZRPIN()); break;
+	case 0xD3: Op_NOP(0); break;
+	case 0xD4: Op_NOP((operand + X) & 0xFF); break;
+	case 0xD5: Op_CMP((operand + X) & 0xFF); break;
+	case 0xD6: Op_DEC((operand + X) & 0xFF); break;
+	case 0xD7: Op_SMB<5>(operand); break;
+	case 0xD8: Op_CLD(0); break;
+	case 0xD9: Op_CMP(operand + Y); break;
+	case 0xDA: Op_PHX(0); break;
+	case 0xDB: Op_STP(0); break;
+	case 0xDC: Op_NOP(operand + X); break;
+	case 0xDD: Op_CMP(operand + X); break;
+	case 0xDE: Op_DEC(operand + X); break;
+	case 0xDF: pc = operand; Op_BBS<5>(Addr_ZEROP()); break;
+	case 0xE0: Op_CPX(operand); break;
+	case 0xE1: pc = operand; Op_SBC(Addr_ZPIXN()); break;
+	case 0xE2: Op_NOP(operand); break;
+	case 0xE3: Op_NOP(0); break;
+	case 0xE4: Op_CPX(operand); break;
+	case 0xE5: Op_SBC(operand); break;
+	case 0xE6: Op_INC(operand); break;
+	case 0xE7: Op_SMB<6>(operand); break;
+	case 0xE8: Op_INX(0); break;
+	case 0xE9: Op_SBC(operand); break;
+	case 0xEA: Op_NOP(0); break;
+	case 0xEB: Op_NOP(0); break;
+	case 0xEC: Op_CPX(operand); break;
+	case 0xED: Op_SBC(operand); break;
+	case 0xEE: Op_INC(operand); break;
+	case 0xEF: pc = operand; Op_BBS<6>(Addr_ZEROP()); break;
+	case 0xF0: Op_BEQ(operand); break;
+	case 0xF1: pc = operand; Op_SBC(Addr_ZPINY()); break;
+	case 0xF2: pc = operand; Op_SBC(Addr_ZRPIN()); break;
+	case 0xF3: Op_NOP(0); break;
+	case 0xF4: Op_NOP((operand + X) & 0xFF); break;
+	case 0xF5: Op_SBC((operand + X) & 0xFF); break;
+	case 0xF6: Op_INC((operand + X) & 0xFF); break;
+	case 0xF7: Op_SMB<7>(operand); break;
+	case 0xF8: Op_SED(0); break;
+	case 0xF9: Op_SBC(operand + Y); break;
+	case 0xFA: Op_PLX(0); break;
+	case 0xFB: Op_NOP(0); break;
+	case 0xFC: Op_NOP(operand + X); break;
+	case 0xFD: Op_SBC(operand + X); break;
+	case 0xFE: Op_INC(operand + X); break;
+	case 0xFF: pc = operand; Op_BBS<7>(Addr_ZEROP()); break;
+	}
+}
+
+// Instructions that can change pc other than by stepping over operands,
+// or stop the processor.
+bool wdc65c02::InstrEndsBlock(uint8_t opcode)
+{
+	uint8_t code = InstrTable[opcode].code;
+
+	if ((opcode & 0x0F) == 0x0F) return true; // BBR, BBS
+	if (InstrTable[opcode].addr == MODE_RELAT) return true;
+
+	return code == OP_JMP || code == OP_JSR ||
+		code == OP_RTS || code == OP_RTI ||
+		code == OP_BRK || code == OP_STP ||
+		code == OP_WAI;
+}
+
+// Registers and bus activity, compared before and after one iteration of
+// a loop that doesn't write memory. If nothing changed, the loop is stuck
+// until something outside the processor happens.
+uint64_t wdc65c02::IdleState()
+{
+	return (uint64_t)A | ((uint64_t)X << 8) | ((uint64_t)Y << 16) |
+		((uint64_t)sp << 24) | ((uint64_t)SyncStatus() << 32) | ((uint64_t)(busReads & 0xFFFFFF) << 40);
+}
+
+// Runs the remaining iterations of an idle loop at once. The last one that
+// fits in the budget is left to run normally, so Run() stops at the same
+// instruction as without skipping.
+void wdc65c02::SkipIdle(
+	int32_t& cyclesRemaining,
+	uint64_t& cycleCount,
+	CycleMethod cycleMethod,
+	uint16_t cycles,
+	uint8_t count
+) {
+	int32_t cost = cycleMethod == CYCLE_COUNT ? cycles : count;
+	if (cyclesRemaining <= 0) return;
+
+	int32_t loops = (cyclesRemaining - 1) / cost;
+	cycleCount += (uint64_t)loops * cycles;
+	idleCycles += (uint64_t)loops * cycles;
+	cyclesRemaining -= loops * cost;
+}
+
+#endif
+
+// EVENTS
+
+// Schedules callback(context, cycle) for when cycleCount reaches the given
+// cycle, counted on the same clock as the cycleCount passed to Run().
+// Callbacks may schedule and cancel events themselves, and raise
+// interrupts. Returns an id for Cancel(), never 0.
+uint32_t wdc65c02::Schedule(uint64_t cycle, EventCallback callback, void* context)
+{
+	if (!events)
+	{
+		events = new Scheduler();
+		events->lastId = 0;
+	}
+
+	Scheduler::Event event = {cycle, ++events->lastId, callback, context};
+	if (event.id == 0) event.id = ++events->lastId;
+
+	events->heap.push_back(event);
+	std::push_heap(events->heap.begin(), events->heap.end(), Scheduler::Later);
+	return event.id;
+}
+
+// Returns false if the event already fired or was cancelled.
+bool wdc65c02::Cancel(uint32_t event)
+{
+	if (!events) return false;
+
+	for (size_t i = 0; i < events->heap.size(); i++)
+	{
+		if (events->heap[i].id != event) continue;
+		events->heap.erase(events->heap.begin() + i);
+		std::make_heap(events->heap.begin(), events->heap.end(), Scheduler::Later);
+		return true;
+	}
+	return false;
+}
+
+// Cycle of the earliest pending event, UINT64_MAX if there is none.
+uint64_t wdc65c02::GetNextEvent()
+{
+	if (!events || events->heap.empty()) return UINT64_MAX;
+	return events->heap.front().cycle;
+}
+
+// Calls back every event due at the given cycle, earliest first.
+void wdc65c02::FireEvents(uint64_t cycle)
+{
+	while (!events->heap.empty() && events->heap.front().cycle <= cycle)
+	{
+		Scheduler::Event event = events->heap.front();
+		std::pop_heap(events->heap.begin(), events->heap.end(), Scheduler::Later);
+		events->heap.pop_back();
+		event.callback(event.context, cycle);
+	}
+}
+
+// PROFILING
+
+// While profiling, Run() counts every pair and triple of consecutive
+// opcodes it executes. The histogram shows which sequences are worth a
+// superinstruction for a given firmware; wdc65c02_fusegen.py turns it into
+// fused handlers for a build of its own. Profiling runs with
+// SWITCH_DISPATCH whatever method is selected.
+#ifndef WDC65C02_NO_PROFILE
+void wdc65c02::SetProfiling(bool enable)
+{
+	if (enable && !profile)
+	{
+		profile = new Profile();
+	}
+	else if (!enable)
+	{
+		delete profile;
+		profile = NULL;
+	}
+}
+
+bool wdc65c02::GetProfiling()
+{
+	return profile != NULL;
+}
+
+void wdc65c02::ClearProfile()
+{
+	if (!profile) return;
+	profile->known = 0;
+	memset(profile->pairs, 0, sizeof(profile->pairs));
+	profile->triples.clear();
+}
+
+uint64_t wdc65c02::GetPairCount(uint8_t first, uint8_t second)
+{
+	if (!profile) return 0;
+	return profile->pairs[(first << 8) | second];
+}
+
+uint64_t wdc65c02::GetTripleCount(uint8_t first, uint8_t second, uint8_t third)
+{
+	if (!profile) return 0;
+	std::unordered_map<uint32_t, uint64_t>::const_iterator it =
+		profile->triples.find((first << 16) | (second << 8) | third);
+	return it == profile->triples.end() ? 0 : it->second;
+}
+
+// Fills ngrams with up to max of the most frequent pairs and triples,
+// most frequent first, and returns how many were written. With ngrams
+// NULL, returns how many different ones were seen.
+size_t wdc65c02::GetProfile(Ngram* ngrams, size_t max)
+{
+	if (!profile) return 0;
+
+	std::vector<Ngram> all;
+	for (uint32_t i = 0; i < 256 * 256; i++)
+	{
+		if (!profile->pairs[i]) continue;
+		Ngram ngram = {2, {(uint8_t)(i >> 8), (uint8_t)i, 0}, profile->pairs[i]};
+		all.push_back(ngram);
+	}
+	std::unordered_map<uint32_t, uint64_t>::const_iterator it;
+	for (it = profile->triples.begin(); it != profile->triples.end(); ++it)
+	{
+		Ngram ngram = {3, {(uint8_t)(it->first >> 16), (uint8_t)(it->first >> 8), (uint8_t)it->first}, it->second};
+		all.push_back(ngram);
+	}
+
+	if (!ngrams) return all.size();
+	if (max > all.size()) max = all.size();
+
+	std::partial_sort(all.begin(), all.begin() + max, all.end(),
+		[](const Ngram& x, const Ngram& y) { return x.count > y.count; });
+	std::copy(all.begin(), all.begin() + max, ngrams);
+	return max;
+}
+
+void wdc65c02::RunProfiled(
+	int32_t& cyclesRemaining,
+	uint64_t& cycleCount,
+	CycleMethod cycleMethod
+) {
+	uint8_t opcode;
+	uint8_t cycles;
+
+	while(cyclesRemaining > 0 && !STOP)
+	{
+		uint16_t address = pc;
+		opcode = Read(pc++);
+		STATS_OPCODE(opcode);
+
+		if (profile)
+		{
+			if (profile->known >= 1) profile->pairs[(profile->last[1] << 8) | opcode]++;
+			if (profile->known >= 2) profile->triples[(profile->last[0] << 16) | (profile->last[1] << 8) | opcode]++;
+			else profile->known++;
+			profile->last[0] = profile->last[1];
+			profile->last[1] = opcode;
+		}
+		if (tracer)
+		{
+			if (tracer->kind == TRACE_INSTRUCTIONS) TraceInstr(cycleCount, address, opcode);
+			else if (tracer->entered || (tracer->key && !tracer->lost)) TraceEntry(cycleCount, address);
+		}
+
+		ExecSwitch(opcode);
+		cycles = InstrTable[opcode].cycles;
+		if (tracer && tracer->kind == TRACE_BRANCHES && tracer->kinds[opcode] != BRANCH_NONE) TraceBranch(cycleCount, address, opcode);
+		if (calls && !calls->period) CountCall(address, opcode, cycles);
+		cycleCount += cycles;
+		cyclesRemaining -=
+			cycleMethod == CYCLE_COUNT        ? cycles
+			/* cycleMethod == INST_COUNT */   : 1;
+	}
+}
+
+// CALL PROFILING
+
+// Attributes cycles to the call stack they were spent in, for finding the
+// routines a firmware spends its time in. In exact mode (a sample period
+// of 0) Run() executes with SWITCH_DISPATCH and keeps a shadow call stack:
+// JSR, BRK and interrupts enter a routine, RTS and RTI return from every
+// call S shows to be over, so code that drops or fakes return addresses
+// doesn't leave the stack out of step. Every instruction's cycles go to
+// its address and to the current stack.
+//
+// With a sample period, Run() keeps the selected dispatch method and an
+// event looks at the processor every samplePeriod cycles instead. The
+// call stack is then read back from the stack page: every pair of bytes
+// pointing just past a JSR is taken for a return address, so the stack
+// page and the code have to be mapped with MapRAM()/MapROM() to be seen.
+// Interrupts are still noted as they are taken. Each sample stands for the
+// cycles since the last one. The first event only notes the cycle the
+// sampling starts on, at the next Run(), so cycles run before it's turned
+// on aren't charged to anything.
+void wdc65c02::SetCallProfiling(bool enable, uint32_t samplePeriod)
+{
+	if (calls && calls->period) Cancel(calls->event);
+	if (!enable)
+	{
+		delete calls;
+		calls = NULL;
+		return;
+	}
+
+	if (!calls)
+	{
+		calls = new CallProfile();
+		CallProfile::Node top = {0, 0, 0};
+		calls->nodes.push_back(top);
+	}
+	calls->frames.clear();
+	calls->period = samplePeriod;
+	calls->sampled = false;
+	if (samplePeriod) calls->event = Schedule(0, SampleCalls, this); // due at once
+}
+
+bool wdc65c02::GetCallProfiling()
+{
+	return calls != NULL;
+}
+
+// Clears the counts. Labels and the current call stack are kept.
+void wdc65c02::ClearCallProfile()
+{
+	if (!calls) return;
+	for (size_t i = 0; i < calls->nodes.size(); i++) calls->nodes[i].cycles = 0;
+	memset(calls->pcCycles, 0, sizeof(calls->pcCycles));
+}
+
+// Names routines in GetFoldedStacks(). Takes the text of a label file, one
+// label per line, in any of:
+//   al C:C000 .reset           VICE, ld65 -Ln
+//   sym id=0,name="reset",...,val=0xC000,...,type=lab   ca65/ld65 --dbgfile
+//   reset = $C000              assembler equates
+// Other lines are skipped. Returns how many labels were added, 0 unless
+// call profiling is on. The first label for an address is the one used,
+// later ones for it aren't counted.
+size_t wdc65c02::LoadLabels(const char* text)
+{
+	if (!calls) return 0;
+
+	size_t count = 0;
+	while (*text)
+	{
+		const char* end = strchr(text, '\n');
+		if (!end) end = text + strlen(text);
+		std::string line(text, end);
+		text = *end ? end + 1 : end;
+
+		const char* p = line.c_str();
+		const char* name = NULL;
+		size_t length = 0;
+		unsigned long value = 0x10000;
+		char* after;
+		while (*p == ' ' || *p == '\t') p++;
+
+		if (!strncmp(p, "al ", 3))
+		{
+			p += 3;
+			while (*p == ' ') p++;
+			if (p[0] && p[1] == ':') p += 2;
+			value = strtoul(p, &after, 16);
+			p = after;
+			while (*p == ' ') p++;
+			if (*p == '.') p++;
+			name = p;
+			length = strcspn(p, " \t\r");
+		}
+		else if (!strncmp(p, "sym", 3) && (p[3] == ' ' || p[3] == '\t'))
+		{
+			const char* n = strstr(p, "name=\"");
+			const char* v = strstr(p, "val=0x");
+			if (!n || !v || !strstr(p, "type=lab")) continue;
+			name = n + 6;
+			length = strcspn(name, "\"");
+			value = strtoul(v + 6, NULL, 16);
+		}
+		else
+		{
+			name = p;
+			length = strcspn(p, " \t:=");
+			p += length;
+			while (*p == ' ' || *p == '\t') p++;
+			if (*p == ':') p++;
+			if (*p++ != '=') continue;
+			while (*p == ' ' || *p == '\t') p++;
+			if (*p == '$') p++;
+			else if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) p += 2;
+			else continue;
+			value = strtoul(p, &after, 16);
+			if (after == p) continue;
+		}
+
+		if (!name || !length || value > 0xFFFF) continue;
+		if (calls->labels.insert(std::make_pair((uint16_t)value, std::string(name, length))).second) count++;
+	}
+	return count;
+}
+
+// Cycles spent in the instruction at the given address.
+uint64_t wdc65c02::GetPCCycles(uint16_t address)
+{
+	if (!calls) return 0;
+	return calls->pcCycles[address];
+}
+
+// Writes one line per call stack seen, the routines from the top level
+// code down separated by semicolons and followed by the cycles spent
+// there, as flamegraph.pl and speedscope take them:
+//   [top];main;print 1234
+// Routines are named by their label, $XXXX without one. Copies as much as
+// fits in buffer, always NUL terminated, and returns the length of the
+// whole text, so with a NULL buffer it returns the size needed less one.
+size_t wdc65c02::GetFoldedStacks(char* buffer, size_t size)
+{
+	std::string text;
+	std::vector<uint32_t> path;
+	char hex[8];
+
+	for (size_t i = 0; calls && i < calls->nodes.size(); i++)
+	{
+		if (!calls->nodes[i].cycles) continue;
+
+		path.clear();
+		for (uint32_t n = (uint32_t)i; n; n = calls->nodes[n].parent) path.push_back(n);
+
+		text += "[top]";
+		for (size_t k = path.size(); k-- > 0; )
+		{
+			uint16_t address = calls->nodes[path[k]].address;
+			std::unordered_map<uint16_t, std::string>::const_iterator it = calls->labels.find(address);
+			text += ';';
+			if (it != calls->labels.end()) text += it->second;
+			else
+			{
+				snprintf(hex, sizeof(hex), "$%04X", address);
+				text += hex;
+			}
+		}
+		text += ' ';
+		text += std::to_string((unsigned long long)calls->nodes[i].cycles);
+		text += '\n';
+	}
+
+	if (buffer && size)
+	{
+		size_t n = std::min(text.size(), size - 1);
+		memcpy(buffer, text.data(), n);
+		buffer[n] = 0;
+	}
+	return text.size();
+}
+
+// After every instruction in exact mode.
+void wdc65c02::CountCall(uint16_t address, uint8_t opcode, uint8_t cycles)
+{
+	calls->pcCycles[address] += cycles;
+	calls->nodes[calls->Current()].cycles += cycles;
+
+	switch (opcode)
+	{
+		case 0x20: EnterCall(pc, sp + 2); break; // JSR
+		case 0x00: EnterCall(pc, sp + 3); break; // BRK
+		case 0x40:                                // RTI
+		case 0x60: ReturnCall(); break;           // RTS
+	}
+	return;
+}
+
+void wdc65c02::EnterCall(uint16_t address, uint8_t before)
+{
+	// anything at or below this level has returned without saying so
+	calls->Unwind(before);
+	if (calls->frames.size() >= 256) return;
+
+	CallProfile::Frame frame = {calls->Child(calls->Current(), address), address, 0, before};
+	calls->frames.push_back(frame);
+	return;
+}
+
+void wdc65c02::ReturnCall()
+{
+	calls->Unwind(sp);
+	return;
+}
+
+// From IRQ() and NMI() once the vector is loaded.
+void wdc65c02::EnterInterrupt()
+{
+	uint8_t before = sp + 3;
+	if (!calls->period)
+	{
+		EnterCall(pc, before);
+		return;
+	}
+
+	// remembered with the return address, which tells whether the frame
+	// is still there when sampling
+	const uint8_t* stack = readPage[0x01];
+	if (!stack) return;
+	calls->Unwind(before);
+	if (calls->frames.size() >= 16) return;
+	CallProfile::Frame frame = {0, pc, (uint16_t)(stack[(uint8_t)(before - 1)] | (stack[before] << 8)), before};
+	calls->frames.push_back(frame);
+	return;
+}
+
+void wdc65c02::SampleCalls(void* context, uint64_t cycle)
+{
+	wdc65c02* cpu = (wdc65c02*)context;
+	CallProfile* calls = cpu->calls;
+	uint64_t weight = cycle - calls->lastSample;
+	bool first = !calls->sampled;
+	calls->lastSample = cycle;
+	calls->sampled = true;
+	calls->event = cpu->Schedule(cycle + calls->period, SampleCalls, context);
+	if (first) return;
+
+	// reads mapped memory only, the bus may have side effects
+	auto mapped = [cpu](uint16_t address, uint8_t& value)
+	{
+		const uint8_t* page = cpu->readPage[address >> 8];
+		if (page) value = page[address & 0xFF];
+		return page != NULL;
+	};
+
+	// walk the stack page from the top of stack up, innermost call first
+	uint16_t entries[128];
+	size_t count = 0;
+	const uint8_t* stack = cpu->readPage[0x01];
+	calls->Unwind(cpu->sp);
+	size_t interrupt = calls->frames.size();
+	for (unsigned s = cpu->sp + 1; stack && s < 0xFF && count < 128; s++)
+	{
+		uint16_t ret = stack[s] | (stack[s + 1] << 8);
+
+		// an interrupt frame: P, then the return address
+		while (interrupt > 0 && calls->frames[interrupt - 1].sp - 2 < (int)s) interrupt--;
+		if (interrupt > 0 && calls->frames[interrupt - 1].sp - 2 == (int)s)
+		{
+			const CallProfile::Frame& frame = calls->frames[--interrupt];
+			if ((stack[s + 1] | (stack[(s + 2) & 0xFF] << 8)) != frame.ret) continue;
+			entries[count++] = frame.address;
+			s += 2;
+			continue;
+		}
+
+		// JSR pushes the address of its last byte
+		uint8_t opcode, low, high;
+		if (!mapped(ret - 2, opcode) || opcode != 0x20) continue;
+		if (!mapped(ret - 1, low) || !mapped(ret, high)) continue;
+		entries[count++] = low | (high << 8);
+		s++;
+	}
+
+	uint32_t node = 0;
+	while (count > 0) node = calls->Child(node, entries[--count]);
+	calls->nodes[node].cycles += weight;
+	calls->pcCycles[cpu->pc] += weight;
+}
+
+// TRACING
+
+// With a trace ring set, Run() records every instruction it executes,
+// using SWITCH_DISPATCH. The ring is made of fixed size blocks: Run()
+// fills one at a time and hands it over by advancing head, the reader
+// writes it out and advances tail. Neither side takes a lock, and when
+// the reader falls behind the records are dropped and counted rather
+// than waiting for it. wdc65c02_trace.h has the reading side and the
+// layout of the records. The operands of code that isn't mapped are read
+// through the callbacks a second time.
+//
+// A record is a flags byte and the cycle it started at, as a delta from
+// the previous record. Within a block an instruction only stores pc when
+// it doesn't follow on from the previous one, and the registers that
+// changed, so most take 3 to 5 bytes. The first record of a block stores
+// everything, so every block can be decoded on its own.
+//
+// In TRACE_BRANCHES mode only control transfers are recorded, as with a
+// hardware branch trace: taken branches, JMP, JSR, RTS, RTI, BRK and
+// interrupts, with their source, cycle and, where the code doesn't tell,
+// target. The decoder steps through the code in between, so the full
+// path costs a small part of the space and time of an instruction trace.
+void wdc65c02::SetTraceRing(TraceRing* ring, TraceMode mode)
+{
+	traceLines = ring != NULL;
+	if (tracer)
+	{
+		if (tracer->block) tracer->Publish();
+		delete tracer;
+		tracer = NULL;
+	}
+	if (!ring) return;
+
+	tracer = new Tracer();
+	tracer->ring = ring;
+	tracer->kind = mode;
+	tracer->nmiLine = 0xFF; // record the lines as they are
+	tracer->key = true;
+
+	// which instructions TraceBranch() looks at, Bxx, BBR and BBS when
+	// they are taken
+	for (int op = 0; op < 256; op++)
+	{
+		Instr instr = InstrTable[op];
+		uint8_t kind = BRANCH_NONE;
+		switch (instr.code)
+		{
+		case OP_JMP: kind = instr.addr == MODE_ABSOL ? BRANCH_JUMP : BRANCH_JUMP | BRANCH_TARGET; break;
+		case OP_BRA: kind = BRANCH_JUMP; break;
+		case OP_JSR: kind = BRANCH_CALL; break;
+		case OP_RTS: kind = BRANCH_RETURN | BRANCH_TARGET; break;
+		case OP_RTI: kind = BRANCH_RTI | BRANCH_TARGET; break;
+		case OP_BRK: kind = BRANCH_BRK | BRANCH_TARGET; break;
+		default:
+			if ((op & 0x1F) == 0x10 || (op & 0x0F) == 0x0F) kind = BRANCH_TAKEN;
+		}
+		tracer->kinds[op] = kind;
+	}
+}
+
+wdc65c02::TraceRing* wdc65c02::GetTraceRing()
+{
+	return tracer ? tracer->ring : NULL;
+}
+
+// Hands the block being filled over to the reader, for a trace that is
+// read while the program runs. SetTraceRing() does the same.
+void wdc65c02::FlushTrace()
+{
+	if (tracer && tracer->block) tracer->Publish();
+}
+
+// Before every instruction while tracing, with the registers it starts
+// with. Writes through a local pointer: stores to the uint8_t block may
+// alias anything, so going through Put() would reload the tracer's fields
+// after every byte.
+void wdc65c02::TraceInstr(uint64_t cycle, uint16_t address, uint8_t opcode)
+{
+	Tracer* t = tracer;
+	if (!t->Reserve(cycle)) return;
+
+	if (t->entered)
+	{
+		t->Put(t->entered);
+		t->PutCycle(cycle);
+		t->entered = 0;
+		t->records++;
+	}
+
+	uint8_t regs[5] = {A, X, Y, SyncStatus(), sp};
+	uint8_t length = InstrLength(opcode);
+	uint64_t delta = cycle - t->cycle;
+
+	// bits 0-4 registers stored, 5 pc stored, 6-7 operand bytes
+	uint8_t flags = (length - 1) << 6;
+	if (t->key || address != t->next) flags |= 0x20;
+	for (int i = 0; i < 5; i++)
+	{
+		if (t->key || regs[i] != t->regs[i]) flags |= 1 << i;
+	}
+	memcpy(t->regs, regs, sizeof(regs));
+	t->cycle = cycle;
+	t->next = address + length;
+	t->key = false;
+	t->records++;
+
+	uint8_t* out = t->block + t->used;
+	*out++ = flags;
+	while (delta >= 0x80)
+	{
+		*out++ = (uint8_t)(delta | 0x80);
+		delta >>= 7;
+	}
+	*out++ = (uint8_t)delta;
+	if (flags & 0x20)
+	{
+		*out++ = address & 0xFF;
+		*out++ = address >> 8;
+	}
+	*out++ = opcode;
+	for (int i = 1; i < length; i++) *out++ = Read(address + i);
+	for (int i = 0; i < 5; i++)
+	{
+		if (flags & (1 << i)) *out++ = regs[i];
+	}
+	t->used = (uint32_t)(out - t->block);
+	return;
+}
+
+// In TRACE_BRANCHES mode, before the first instruction of an interrupt
+// handler, and before the first one traced, so the path starts there.
+void wdc65c02::TraceEntry(uint64_t cycle, uint16_t address)
+{
+	Tracer* t = tracer;
+	uint8_t type = t->entered;
+	t->entered = 0;
+	if (!t->Reserve(cycle)) return;
+
+	if (t->key) t->Sync(cycle, type ? t->from : address);
+	if (!type) return;
+	t->Put(type);
+	t->PutCycle(cycle);
+	t->PutAddress(t->from);
+	t->PutAddress(address);
+	t->records++;
+	return;
+}
+
+// In TRACE_BRANCHES mode, after every instruction that may transfer
+// control. Every JMP, JSR, RTS, RTI, BRK and BRA is recorded, and
+// conditional branches when taken. The target is left out where the
+// decoder finds it in the code.
+void wdc65c02::TraceBranch(uint64_t cycle, uint16_t address, uint8_t opcode)
+{
+	Tracer* t = tracer;
+	uint8_t kind = t->kinds[opcode];
+	if (kind == BRANCH_TAKEN && pc == (uint16_t)(address + InstrLength(opcode))) return;
+	if (!t->Reserve(cycle)) return;
+
+	if (t->key) t->Sync(cycle, address);
+	t->Put(kind);
+	t->PutCycle(cycle);
+	t->PutAddress(address);
+	if (kind & BRANCH_TARGET) t->PutAddress(pc);
+	t->records++;
+	return;
+}
+
+// Between slices of Run(), which end at every event, so lines raised by
+// an event are stamped with its cycle.
+void wdc65c02::TraceLines(uint64_t cycle)
+{
+	Tracer* t = tracer;
+	uint32_t irq = irqLines;
+	uint8_t nmi = nmiLine;
+	if (irq == t->irqLines && nmi == t->nmiLine) return;
+	if (!t->Reserve(cycle)) return;
+
+	t->Put(TRACE_LINES);
+	t->PutCycle(cycle);
+	for (int i = 0; i < 4; i++) t->Put((uint8_t)(irq >> (i * 8)));
+	t->Put(nmi);
+	t->irqLines = irq;
+	t->nmiLine = nmi;
+	t->records++;
+	return;
+}
+
+#else
+
+void wdc65c02::SetProfiling(bool enable)
+{
+}
+
+bool wdc65c02::GetProfiling()
+{
+	return false;
+}
+
+void wdc65c02::ClearProfile()
+{
+}
+
+uint64_t wdc65c02::GetPairCount(uint8_t first, uint8_t second)
+{
+	return 0;
+}
+
+uint64_t wdc65c02::GetTripleCount(uint8_t first, uint8_t second, uint8_t third)
+{
+	return 0;
+}
+
+size_t wdc65c02::GetProfile(Ngram* ngrams, size_t max)
+{
+	return 0;
+}
+
+void wdc65c02::SetCallProfiling(bool enable, uint32_t samplePeriod)
+{
+}
+
+bool wdc65c02::GetCallProfiling()
+{
+	return false;
+}
+
+void wdc65c02::ClearCallProfile()
+{
+}
+
+size_t wdc65c02::LoadLabels(const char* text)
+{
+	return 0;
+}
+
+uint64_t wdc65c02::GetPCCycles(uint16_t address)
+{
+	return 0;
+}
+
+size_t wdc65c02::GetFoldedStacks(char* buffer, size_t size)
+{
+	if (buffer && size) buffer[0] = 0;
+	return 0;
+}
+
+void wdc65c02::SetTraceRing(TraceRing* ring, TraceMode mode)
+{
+}
+
+wdc65c02::TraceRing* wdc65c02::GetTraceRing()
+{
+	return NULL;
+}
+
+void wdc65c02::FlushTrace()
+{
+}
+
+#endif
+
+// STATISTICS
+
+// Built with WDC65C02_STATS, every instruction Run() executes is counted
+// by opcode, along with interrupts taken and WAI/STP. Cycles and
+// addressing modes follow from the opcode counts, so they are only worked
+// out here. Iterations passed over by idle skipping are not counted, they
+// show up in GetIdleCycles(). Returns false if the counters are not built
+// in.
+bool wdc65c02::GetStats(Stats* out)
+{
+	if (!stats) return false;
+
+	*out = *stats;
+	memset(out->modes, 0, sizeof(out->modes));
+	for (int i = 0; i < 256; i++)
+	{
+		out->cycles[i] = stats->opcodes[i] * InstrTable[i].cycles;
+		out->modes[InstrTable[i].addr] += stats->opcodes[i];
+	}
+	return true;
+}
+
+void wdc65c02::ClearStats()
+{
+	if (!stats) return;
+	memset(stats, 0, sizeof(Stats));
+}
+
+// MEMORY MAP
+
+// Pages mapped here are accessed directly, without going through the
+// callbacks. The range is handled in whole pages: the low byte of both
+// address and size is ignored, and memory must hold at least size bytes.
+void wdc65c02::MapRAM(uint16_t address, uint32_t size, uint8_t* memory)
+{
+	uint16_t first = address >> 8;
+	uint16_t count = size >> 8;
+
+	FlushBlockCache();
+
+	for (uint16_t i = 0; i < count && first + i < 256; i++)
+	{
+		ReleasePage(first + i);
+		readPage[first + i] = memory + (i << 8);
+		writePage[first + i] = memory + (i << 8);
+		pageFlags[first + i] = PAGE_RAM;
+	}
+}
+
+// Reads come from memory, writes still go to the write callback.
+void wdc65c02::MapROM(uint16_t address, uint32_t size, const uint8_t* memory)
+{
+	uint16_t first = address >> 8;
+	uint16_t count = size >> 8;
+
+	FlushBlockCache();
+
+	for (uint16_t i = 0; i < count && first + i < 256; i++)
+	{
+		ReleasePage(first + i);
+		readPage[first + i] = memory + (i << 8);
+		writePage[first + i] = NULL;
+		pageFlags[first + i] = 0;
+	}
+}
+
+// Both reads and writes go to the callbacks (memory mapped I/O).
+void wdc65c02::MapBus(uint16_t address, uint32_t size)
+{
+	uint16_t first = address >> 8;
+	uint16_t count = size >> 8;
+
+	FlushBlockCache();
+
+	for (uint16_t i = 0; i < count && first + i < 256; i++)
+	{
+		ReleasePage(first + i);
+		readPage[first + i] = NULL;
+		writePage[first + i] = NULL;
+		pageFlags[first + i] = 0;
+	}
+}
+
+// COPY-ON-WRITE AND FORK
+
+struct wdc65c02::SharedPage
+{
+	std::atomic<uint32_t> refs;
+	uint8_t data[256];
+};
+
+// Returns an instance with the same registers and memory, and otherwise
+// independent from this one. RAM pages are not copied: both instances
+// keep reading the same memory, and a page is duplicated the first time
+// either of them writes to it. The buffers given to MapRAM() then keep
+// the contents they had at the first fork; use Peek() to see the memory
+// of an instance after that.
+wdc65c02* wdc65c02::Fork()
+{
+	for (int i = 0; i < 256; i++)
+	{
+		if (pageFlags[i] & PAGE_RAM)
+		{
+			writePage[i] = NULL;
+			pageFlags[i] |= PAGE_COW;
+		}
+	}
+
+	wdc65c02* child = new wdc65c02(*this);
+
+	for (int i = 0; i < 256; i++)
+	{
+		if (ownedPage[i]) ownedPage[i]->refs++;
+		child->pageFlags[i] &= ~PAGE_CODE;
+	}
+
+	// the child starts with an empty block cache of its own
+	child->blocks = NULL;
+	child->traces = NULL;
+	child->profile = NULL;
+	child->calls = NULL;
+	child->tracer = NULL;
+	child->traceLines = 0;
+	child->events = NULL;
+	child->stats = NULL;
+#ifdef WDC65C02_STATS
+	child->stats = new Stats(); // counts what the child runs
+#endif
+	return child;
+}
+
+// Called for writes to a page without a direct write pointer that has
+// flags set. Returns the pointer to write to, or NULL for the callback.
+// Blocks are only dropped when the write lands in RAM: a write to ROM goes
+// to the callback and leaves the code as it is, a host that switches banks
+// on it calls MapROM() or FlushBlockCache().
+uint8_t* wdc65c02::WriteTrap(uint8_t page)
+{
+	if ((pageFlags[page] & PAGE_CODE) && (pageFlags[page] & PAGE_RAM)) InvalidatePage(page);
+	if (pageFlags[page] & PAGE_COW) CopyPage(page);
+
+	// RAM with nothing left to trap is written directly again
+	if (pageFlags[page] == PAGE_RAM) writePage[page] = (uint8_t*)readPage[page];
+	return writePage[page];
+}
+
+void wdc65c02::CopyPage(uint8_t page)
+{
+	SharedPage* shared = ownedPage[page];
+
+	pageFlags[page] &= ~PAGE_COW;
+
+	// last instance holding the page, it can be written in place
+	if (shared && shared->refs == 1) return;
+
+	SharedPage* copy = new SharedPage;
+	copy->refs = 1;
+	memcpy(copy->data, readPage[page], 256);
+
+	if (shared && --shared->refs == 0) delete shared;
+	ownedPage[page] = copy;
+	readPage[page] = copy->data;
+}
+
+void wdc65c02::ReleasePage(uint8_t page)
+{
+	SharedPage* shared = ownedPage[page];
+
+	if (shared && --shared->refs == 0) delete shared;
+	ownedPage[page] = NULL;
+}
+
+uint8_t wdc65c02::Peek(uint16_t address)
+{
+	return Read(address);
+}
+
+void wdc65c02::Poke(uint16_t address, uint8_t value)
+{
+	Write(address, value);
+}
+
+void* wdc65c02::GetBusContext()
+{
+	return busContext;
+}
+
+void wdc65c02::SetBusContext(void* context)
+{
+	busContext = context;
+}
+
+
+// SNAPSHOTS
+
+// Snapshot layout (all values little endian):
+//   "W65S", version
+//   A, X, Y, sp, pc (2 bytes), status, STOP
+//   reset_A, reset_X, reset_Y, reset_sp, reset_status
+//   IRQ lines (4 bytes), NMI line, NMI latch
+//   number of RAM pages (2 bytes)
+//   per RAM page: page index, kind (0 = all zero, 1 = raw), 256 bytes if raw
+// Only RAM pages (mapped with MapRAM(), or their copies after Fork()) are
+// stored, ROM and bus pages belong to the host and are not part of the
+// snapshot.
 
-	return;
-}
+static const uint8_t snapshotMagic[4] = { 'W', '6', '5', 'S' };
+static const uint8_t snapshotVersion = 1;
+static const size_t snapshotHeader = 4 + 1 + 8 + 5 + 6 + 2;
 
-void wdc65c02::StackPush(uint8_t byte)
+size_t wdc65c02::GetStateSize()
 {
-	Write(0x0100 + sp, byte);
-	if(sp == 0x00) sp = 0xFF;
-	else sp--;
-}
+	size_t size = snapshotHeader;
 
-uint8_t wdc65c02::StackPop()
-{
-	if(sp == 0xFF) sp = 0x00;
-	else sp++;
-	return Read(0x0100 + sp);
+	for (int i = 0; i < 256; i++)
+	{
+		if (pageFlags[i] & PAGE_RAM) size += 2 + 256;
+	}
+	return size;
 }
 
-void wdc65c02::IRQ()
+// Returns the number of bytes written, or 0 if the buffer is too small.
+// GetStateSize() is an upper bound for the size needed.
+size_t wdc65c02::SaveState(uint8_t* buffer, size_t size)
 {
-	if (STOP & 0b01) return;
-	if (STOP & 0b10) {
-		STOP &= 0b11111101;
-		pc++;
-	}
-	if(!IF_INTERRUPT())
+	uint8_t* p = buffer;
+	uint8_t* end = buffer + size;
+	uint16_t pages = 0;
+
+	if (size < snapshotHeader) return 0;
+
+	memcpy(p, snapshotMagic, 4); p += 4;
+	*p++ = snapshotVersion;
+
+	*p++ = A;
+	*p++ = X;
+	*p++ = Y;
+	*p++ = sp;
+	*p++ = pc & 0xFF;
+	*p++ = (pc >> 8) & 0xFF;
+	*p++ = SyncStatus();
+	*p++ = STOP & 0b11;
+
+	*p++ = reset_A;
+	*p++ = reset_X;
+	*p++ = reset_Y;
+	*p++ = reset_sp;
+	*p++ = reset_status;
+
+	for (int i = 0; i < 4; i++)
 	{
-		//SET_BREAK(0);
-		StackPush((pc >> 8) & 0xFF);
-		StackPush(pc & 0xFF);
-		StackPush((status & ~BREAK) | CONSTANT);
-		SET_INTERRUPT(1);
-		SET_DECIMAL(0);
+		*p++ = (irqLines >> (i * 8)) & 0xFF;
+	}
+	*p++ = nmiLine;
+	*p++ = nmiLatch;
 
-		// load PC from irq vector
-		uint8_t pcl = Read(irqVectorL);
-		uint8_t pch = Read(irqVectorH);
-		pc = (pch << 8) + pcl;
+	for (int i = 0; i < 256; i++)
+	{
+		if (pageFlags[i] & PAGE_RAM) pages++;
 	}
-	return;
-}
+	*p++ = pages & 0xFF;
+	*p++ = (pages >> 8) & 0xFF;
 
-void wdc65c02::NMI()
-{
-	if (STOP & 0b01) return;
-	if (STOP & 0b10) {
-		STOP &= 0b11111101;
-		pc++;
+	for (int i = 0; i < 256; i++)
+	{
+		const uint8_t* page = readPage[i];
+		bool zero = true;
+
+		if (!(pageFlags[i] & PAGE_RAM)) continue;
+
+		for (int j = 0; j < 256 && zero; j++)
+		{
+			if (page[j]) zero = false;
+		}
+
+		if (end - p < (zero ? 2 : 2 + 256)) return 0;
+		*p++ = i;
+		*p++ = zero ? 0 : 1;
+		if (!zero)
+		{
+			memcpy(p, page, 256);
+			p += 256;
+		}
 	}
-	//SET_BREAK(0);
-	StackPush((pc >> 8) & 0xFF);
-	StackPush(pc & 0xFF);
-	StackPush((status & ~BREAK) | CONSTANT);
-	SET_INTERRUPT(1);
-	SET_DECIMAL(0);
 
-	// load PC from NMI vector
-	uint8_t pcl = Read(nmiVectorL);
-	uint8_t pch = Read(nmiVectorH);
-	pc = (pch << 8) + pcl;
-	return;
+	return p - buffer;
 }
 
-void wdc65c02::Run(
-	int32_t cyclesRemaining,
-	uint64_t& cycleCount,
-	CycleMethod cycleMethod
-) {
-	uint8_t opcode;
-	Instr instr;
+// Restores a snapshot taken with SaveState(). Every page stored in it must
+// be mapped as RAM here too. Nothing is changed if the snapshot is invalid.
+bool wdc65c02::LoadState(const uint8_t* buffer, size_t size)
+{
+	const uint8_t* end = buffer + size;
+	uint16_t pages;
 
-	while(cyclesRemaining > 0 && !STOP)
+	if (size < snapshotHeader) return false;
+	if (memcmp(buffer, snapshotMagic, 4) != 0) return false;
+	if (buffer[4] != snapshotVersion) return false;
+
+	// validate the page records before touching anything
+	const uint8_t* p = buffer + snapshotHeader;
+	pages = buffer[snapshotHeader - 2] | (buffer[snapshotHeader - 1] << 8);
+	for (uint16_t i = 0; i < pages; i++)
 	{
-		// fetch
-		opcode = Read(pc++);
+		if (end - p < 2) return false;
+		if (!(pageFlags[p[0]] & PAGE_RAM) || p[1] > 1) return false;
+		if (p[1] && end - p < 2 + 256) return false;
+		p += p[1] ? 2 + 256 : 2;
+	}
 
-		// decode
-		instr = InstrTable[opcode];
+	p = buffer + 5;
+	A = *p++;
+	X = *p++;
+	Y = *p++;
+	sp = *p++;
+	pc = p[0] | (p[1] << 8); p += 2;
+	LoadStatus(*p++);
+	STOP = *p++ & 0b11;
+
+	reset_A = *p++;
+	reset_X = *p++;
+	reset_Y = *p++;
+	reset_sp = *p++;
+	reset_status = *p++;
+
+	irqLines = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+	nmiLine = p[4];
+	nmiLatch = p[5];
+	p += 6;
+	CheckInterrupts();
+
+	p += 2;
+	for (uint16_t i = 0; i < pages; i++)
+	{
+		uint8_t* page = writePage[p[0]] ? writePage[p[0]] : WriteTrap(p[0]);
 
-		// execute
-		Exec(instr);
-		cycleCount += instr.cycles;
-		cyclesRemaining -=
-			cycleMethod == CYCLE_COUNT        ? instr.cycles
-			/* cycleMethod == INST_COUNT */   : 1;
+		if (p[1])
+		{
+			memcpy(page, p + 2, 256);
+			p += 2 + 256;
+		}
+		else
+		{
+			memset(page, 0, 256);
+			p += 2;
+		}
 	}
-}
 
-void wdc65c02::Exec(Instr i)
-{
-	uint16_t src = (this->*i.addr)();
-	(this->*i.code)(src);
+	return true;
 }
 
 uint16_t wdc65c02::GetPC()
@@ -1082,7 +3278,7 @@ uint8_t wdc65c02::GetS()
 
 uint8_t wdc65c02::GetP()
 {
-    return status;
+    return SyncStatus();
 }
 
 uint8_t wdc65c02::GetA()
@@ -1102,7 +3298,7 @@ uint8_t wdc65c02::GetY()
 
 uint8_t wdc65c02::GetSTOP()
 {
-    return STOP;
+    return STOP & 0b11;
 }
 
 void wdc65c02::SetPC(uint16_t address) {
@@ -1114,7 +3310,8 @@ void wdc65c02::SetS(uint8_t value) {
 }
 
 void wdc65c02::SetP(uint8_t value) {
-	status = value | CONSTANT | BREAK;
+	LoadStatus(value | CONSTANT | BREAK);
+	CheckInterrupts();
 }
 
 void wdc65c02::SetA(uint8_t value) {
@@ -1307,313 +3504,103 @@ uint16_t wdc65c02::Addr_ZPIXN()
 
 uint16_t wdc65c02::Addr_ZRPIX()
 {
-	uint16_t addr = (Read(pc++) + X) & 0xFF;
-	return addr;
-}
-
-uint16_t wdc65c02::Addr_ZRPIY()
-{
-	uint16_t addr = (Read(pc++) + Y) & 0xFF;
-	return addr;
-}
-
-uint16_t wdc65c02::Addr_ZRPIN()
-{
-	uint16_t zeroL;
-	uint16_t zeroH;
-	uint16_t addr;
-
-	zeroL = Read(pc++);
-	zeroH = (zeroL + 1) & 0xFF;
-	addr = Read(zeroL) + (Read(zeroH) << 8);
-	
-	return addr;
-}
-
-uint16_t wdc65c02::Addr_ZPINY()
-{
-	uint16_t zeroL;
-	uint16_t zeroH;
-	uint16_t addr;
-
-	zeroL = Read(pc++);
-	zeroH = (zeroL + 1) & 0xFF;
-	addr = Read(zeroL) + (Read(zeroH) << 8) + Y;
-
-	return addr;
-}
-
-
-// Operations
-
-void wdc65c02::Op_ADC(uint16_t src)
-{
-	uint8_t m = Read(src);
-	unsigned int tmp = m + A + (IF_CARRY() ? 1 : 0);
-	SET_ZERO(!(tmp & 0xFF));
-	if (IF_DECIMAL())
-	{
-		if (((A & 0xF) + (m & 0xF) + (IF_CARRY() ? 1 : 0)) > 9) tmp += 6;
-		SET_OVERFLOW(!((A ^ m) & 0x80) && ((A ^ tmp) & 0x80));
-		if (tmp > 0x99)
-		{
-			tmp += 96;
-		}
-		SET_ZERO(!(tmp & 0xFF));
-		SET_NEGATIVE(tmp & 0x80);
-		SET_CARRY(tmp > 0x99);
-	}
-	else
-	{
-		SET_NEGATIVE(tmp & 0x80);
-		SET_OVERFLOW(!((A ^ m) & 0x80) && ((A ^ tmp) & 0x80));
-		SET_CARRY(tmp > 0xFF);
-	}
-
-	A = tmp & 0xFF;
-	return;
-}
-
-void wdc65c02::Op_AND(uint16_t src)
-{
-	uint8_t m = Read(src);
-	uint8_t res = m & A;
-	SET_NEGATIVE(res & 0x80);
-	SET_ZERO(!res);
-	A = res;
-	return;
-}
-
-void wdc65c02::Op_ASL(uint16_t src)
-{
-	uint8_t m = Read(src);
-	SET_CARRY(m & 0x80);
-	m <<= 1;
-	m &= 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
-	Write(src, m);
-	return;
-}
-
-void wdc65c02::Op_ASL_ACC(uint16_t src)
-{
-	uint8_t m = A;
-	SET_CARRY(m & 0x80);
-	m <<= 1;
-	m &= 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
-	A = m;
-	return;
-}
-
-
-// BRANCH ON BIT RESET INSTRUCTIONS
-
-void wdc65c02::Op_BBR0(uint16_t src)
-{
-	uint16_t offset;
-
-	if (~Read(src) & 0b00000001)
-	{
-		offset = (uint16_t)Read(pc++);
-		if (offset & 0x80) offset |= 0xFF00;
-		pc += (int16_t)offset;  // RELATIVE
-	} else {
-		pc++;
-	}
-	return;
-}
-
-void wdc65c02::Op_BBR1(uint16_t src)
-{
-	uint16_t offset;
-
-	if (~Read(src) & 0b00000010)
-	{
-		offset = (uint16_t)Read(pc++);
-		if (offset & 0x80) offset |= 0xFF00;
-		pc += (int16_t)offset;  // RELATIVE
-	} else {
-		pc++;
-	}
-	return;
-}
-
-void wdc65c02::Op_BBR2(uint16_t src)
-{
-	uint16_t offset;
-
-	if (~Read(src) & 0b00000100)
-	{
-		offset = (uint16_t)Read(pc++);
-		if (offset & 0x80) offset |= 0xFF00;
-		pc += (int16_t)offset;  // RELATIVE
-	} else {
-		pc++;
-	}
-	return;
-}
-
-void wdc65c02::Op_BBR3(uint16_t src)
-{
-	uint16_t offset;
-
-	if (~Read(src) & 0b00001000)
-	{
-		offset = (uint16_t)Read(pc++);
-		if (offset & 0x80) offset |= 0xFF00;
-		pc += (int16_t)offset;  // RELATIVE
-	} else {
-		pc++;
-	}
-	return;
-}
-
-void wdc65c02::Op_BBR4(uint16_t src)
-{
-	uint16_t offset;
-
-	if (~Read(src) & 0b00010000)
-	{
-		offset = (uint16_t)Read(pc++);
-		if (offset & 0x80) offset |= 0xFF00;
-		pc += (int16_t)offset;  // RELATIVE
-	} else {
-		pc++;
-	}
-	return;
-}
-
-void wdc65c02::Op_BBR5(uint16_t src)
-{
-	uint16_t offset;
-
-	if (~Read(src) & 0b00100000)
-	{
-		offset = (uint16_t)Read(pc++);
-		if (offset & 0x80) offset |= 0xFF00;
-		pc += (int16_t)offset;  // RELATIVE
-	} else {
-		pc++;
-	}
-	return;
+	uint16_t addr = (Read(pc++) + X) & 0xFF;
+	return addr;
 }
 
-void wdc65c02::Op_BBR6(uint16_t src)
+uint16_t wdc65c02::Addr_ZRPIY()
 {
-	uint16_t offset;
+	uint16_t addr = (Read(pc++) + Y) & 0xFF;
+	return addr;
+}
 
-	if (~Read(src) & 0b01000000)
-	{
-		offset = (uint16_t)Read(pc++);
-		if (offset & 0x80) offset |= 0xFF00;
-		pc += (int16_t)offset;  // RELATIVE
-	} else {
-		pc++;
-	}
-	return;
+uint16_t wdc65c02::Addr_ZRPIN()
+{
+	uint16_t zeroL;
+	uint16_t zeroH;
+	uint16_t addr;
+
+	zeroL = Read(pc++);
+	zeroH = (zeroL + 1) & 0xFF;
+	addr = Read(zeroL) + (Read(zeroH) << 8);
+	
+	return addr;
 }
 
-void wdc65c02::Op_BBR7(uint16_t src)
+uint16_t wdc65c02::Addr_ZPINY()
 {
-	uint16_t offset;
+	uint16_t zeroL;
+	uint16_t zeroH;
+	uint16_t addr;
 
-	if (~Read(src) & 0b10000000)
-	{
-		offset = (uint16_t)Read(pc++);
-		if (offset & 0x80) offset |= 0xFF00;
-		pc += (int16_t)offset;  // RELATIVE
-	} else {
-		pc++;
-	}
-	return;
+	zeroL = Read(pc++);
+	zeroH = (zeroL + 1) & 0xFF;
+	addr = Read(zeroL) + (Read(zeroH) << 8) + Y;
+
+	return addr;
 }
 
 
-// BRANCH ON BIT SET INSTRUCTIONS
+// Operations
 
-void wdc65c02::Op_BBS0(uint16_t src)
+// Binary and decimal mode share one branch free path, the decimal nibble
+// corrections are masked off when D is clear.
+void wdc65c02::Op_ADC(uint16_t src)
 {
-	uint16_t offset;
-
-	if (Read(src) & 0b00000001)
-	{
-		offset = (uint16_t)Read(pc++);
-		if (offset & 0x80) offset |= 0xFF00;
-		pc += (int16_t)offset;  // RELATIVE
-	} else {
-		pc++;
-	}
+	uint8_t m = Read(src);
+	unsigned int carry = status & CARRY;
+	unsigned int decimal = 0U - ((status & DECIMAL) >> 3);
+	unsigned int tmp = A + m + carry;
+	tmp += 0x06 & decimal & (0U - (((A & 0x0F) + (m & 0x0F) + carry) > 9));
+	unsigned int overflow = ~(A ^ m) & (A ^ tmp) & 0x80;
+	tmp += 0x60 & decimal & (0U - (tmp > 0x99));
+	unsigned int limit = 0xFF ^ (0x66 & decimal); // 0x99 in decimal mode
+	status = (status & ~(OVERFLOW | CARRY)) | (overflow >> 1) | (tmp > limit);
+	SET_NZ((uint8_t)tmp);
+	A = tmp & 0xFF;
 	return;
 }
 
-void wdc65c02::Op_BBS1(uint16_t src)
+void wdc65c02::Op_AND(uint16_t src)
 {
-	uint16_t offset;
-
-	if (Read(src) & 0b00000010)
-	{
-		offset = (uint16_t)Read(pc++);
-		if (offset & 0x80) offset |= 0xFF00;
-		pc += (int16_t)offset;  // RELATIVE
-	} else {
-		pc++;
-	}
+	uint8_t m = Read(src);
+	uint8_t res = m & A;
+	SET_NZ(res);
+	A = res;
 	return;
 }
 
-void wdc65c02::Op_BBS2(uint16_t src)
+void wdc65c02::Op_ASL(uint16_t src)
 {
-	uint16_t offset;
-
-	if (Read(src) & 0b00000100)
-	{
-		offset = (uint16_t)Read(pc++);
-		if (offset & 0x80) offset |= 0xFF00;
-		pc += (int16_t)offset;  // RELATIVE
-	} else {
-		pc++;
-	}
+	uint8_t m = Read(src);
+	SET_CARRY(m & 0x80);
+	m <<= 1;
+	m &= 0xFF;
+	SET_NZ(m);
+	Write(src, m);
 	return;
 }
 
-void wdc65c02::Op_BBS3(uint16_t src)
+void wdc65c02::Op_ASL_ACC(uint16_t src)
 {
-	uint16_t offset;
-
-	if (Read(src) & 0b00001000)
-	{
-		offset = (uint16_t)Read(pc++);
-		if (offset & 0x80) offset |= 0xFF00;
-		pc += (int16_t)offset;  // RELATIVE
-	} else {
-		pc++;
-	}
+	uint8_t m = A;
+	SET_CARRY(m & 0x80);
+	m <<= 1;
+	m &= 0xFF;
+	SET_NZ(m);
+	A = m;
 	return;
 }
 
-void wdc65c02::Op_BBS4(uint16_t src)
-{
-	uint16_t offset;
 
-	if (Read(src) & 0b00010000)
-	{
-		offset = (uint16_t)Read(pc++);
-		if (offset & 0x80) offset |= 0xFF00;
-		pc += (int16_t)offset;  // RELATIVE
-	} else {
-		pc++;
-	}
-	return;
-}
+// BRANCH ON BIT RESET INSTRUCTIONS
 
-void wdc65c02::Op_BBS5(uint16_t src)
+template<uint8_t bit>
+void wdc65c02::Op_BBR(uint16_t src)
 {
 	uint16_t offset;
 
-	if (Read(src) & 0b00100000)
+	if (~Read(src) & (1 << bit))
 	{
 		offset = (uint16_t)Read(pc++);
 		if (offset & 0x80) offset |= 0xFF00;
@@ -1624,26 +3611,15 @@ void wdc65c02::Op_BBS5(uint16_t src)
 	return;
 }
 
-void wdc65c02::Op_BBS6(uint16_t src)
-{
-	uint16_t offset;
 
-	if (Read(src) & 0b01000000)
-	{
-		offset = (uint16_t)Read(pc++);
-		if (offset & 0x80) offset |= 0xFF00;
-		pc += (int16_t)offset;  // RELATIVE
-	} else {
-		pc++;
-	}
-	return;
-}
+// BRANCH ON BIT SET INSTRUCTIONS
 
-void wdc65c02::Op_BBS7(uint16_t src)
+template<uint8_t bit>
+void wdc65c02::Op_BBS(uint16_t src)
 {
 	uint16_t offset;
 
-	if (Read(src) & 0b10000000)
+	if (Read(src) & (1 << bit))
 	{
 		offset = (uint16_t)Read(pc++);
 		if (offset & 0x80) offset |= 0xFF00;
@@ -1686,8 +3662,9 @@ void wdc65c02::Op_BIT(uint16_t src)
 {
 	uint8_t m = Read(src);
 	uint8_t res = m & A;
-	SET_NEGATIVE(res & 0x80);
-	status = (status & 0x3F) | (uint8_t)(m & 0xC0) | CONSTANT | BREAK;
+	SET_NEGATIVE(m & 0x80);
+	SET_OVERFLOW(m & 0x40);
+	status |= CONSTANT | BREAK;
 	SET_ZERO(!res);
 	return;
 }
@@ -1740,7 +3717,7 @@ void wdc65c02::Op_BRK(uint16_t src)
 	pc++;
 	StackPush((pc >> 8) & 0xFF);
 	StackPush(pc & 0xFF);
-	StackPush(status | CONSTANT | BREAK);
+	StackPush(SyncStatus() | CONSTANT | BREAK);
 	SET_INTERRUPT(1);
 	SET_DECIMAL(0);
 	pc = (Read(irqVectorH) << 8) + Read(irqVectorL);
@@ -1780,6 +3757,7 @@ void wdc65c02::Op_CLD(uint16_t src)
 void wdc65c02::Op_CLI(uint16_t src)
 {
 	SET_INTERRUPT(0);
+	CheckInterrupts();
 	return;
 }
 
@@ -1789,30 +3767,29 @@ void wdc65c02::Op_CLV(uint16_t src)
 	return;
 }
 
+// CMP, CPX and CPY
+void wdc65c02::Compare(uint8_t reg, uint8_t m)
+{
+	status = (status & ~CARRY) | (reg >= m);
+	SET_NZ((uint8_t)(reg - m));
+	return;
+}
+
 void wdc65c02::Op_CMP(uint16_t src)
 {
-	unsigned int tmp = A - Read(src);
-	SET_CARRY(tmp < 0x100);
-	SET_NEGATIVE(tmp & 0x80);
-	SET_ZERO(!(tmp & 0xFF));
+	Compare(A, Read(src));
 	return;
 }
 
 void wdc65c02::Op_CPX(uint16_t src)
 {
-	unsigned int tmp = X - Read(src);
-	SET_CARRY(tmp < 0x100);
-	SET_NEGATIVE(tmp & 0x80);
-	SET_ZERO(!(tmp & 0xFF));
+	Compare(X, Read(src));
 	return;
 }
 
 void wdc65c02::Op_CPY(uint16_t src)
 {
-	unsigned int tmp = Y - Read(src);
-	SET_CARRY(tmp < 0x100);
-	SET_NEGATIVE(tmp & 0x80);
-	SET_ZERO(!(tmp & 0xFF));
+	Compare(Y, Read(src));
 	return;
 }
 
@@ -1820,8 +3797,7 @@ void wdc65c02::Op_DEC(uint16_t src)
 {
 	uint8_t m = Read(src);
 	m = (m - 1) & 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	Write(src, m);
 	return;
 }
@@ -1830,8 +3806,7 @@ void wdc65c02::Op_DEC_ACC(uint16_t src)
 {
 	uint8_t m = A;
 	m = (m - 1) & 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	A = m;
 	return;
 }
@@ -1840,8 +3815,7 @@ void wdc65c02::Op_DEX(uint16_t src)
 {
 	uint8_t m = X;
 	m = (m - 1) & 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	X = m;
 	return;
 }
@@ -1850,8 +3824,7 @@ void wdc65c02::Op_DEY(uint16_t src)
 {
 	uint8_t m = Y;
 	m = (m - 1) & 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	Y = m;
 	return;
 }
@@ -1860,8 +3833,7 @@ void wdc65c02::Op_EOR(uint16_t src)
 {
 	uint8_t m = Read(src);
 	m = A ^ m;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	A = m;
 }
 
@@ -1869,8 +3841,7 @@ void wdc65c02::Op_INC(uint16_t src)
 {
 	uint8_t m = Read(src);
 	m = (m + 1) & 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	Write(src, m);
 }
 
@@ -1878,8 +3849,7 @@ void wdc65c02::Op_INC_ACC(uint16_t src)
 {
 	uint8_t m = A;
 	m = (m + 1) & 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	A = m;
 }
 
@@ -1887,8 +3857,7 @@ void wdc65c02::Op_INX(uint16_t src)
 {
 	uint8_t m = X;
 	m = (m + 1) & 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	X = m;
 }
 
@@ -1896,8 +3865,7 @@ void wdc65c02::Op_INY(uint16_t src)
 {
 	uint8_t m = Y;
 	m = (m + 1) & 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	Y = m;
 }
 
@@ -1917,24 +3885,21 @@ void wdc65c02::Op_JSR(uint16_t src)
 void wdc65c02::Op_LDA(uint16_t src)
 {
 	uint8_t m = Read(src);
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	A = m;
 }
 
 void wdc65c02::Op_LDX(uint16_t src)
 {
 	uint8_t m = Read(src);
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	X = m;
 }
 
 void wdc65c02::Op_LDY(uint16_t src)
 {
 	uint8_t m = Read(src);
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	Y = m;
 }
 
@@ -1943,8 +3908,7 @@ void wdc65c02::Op_LSR(uint16_t src)
 	uint8_t m = Read(src);
 	SET_CARRY(m & 0x01);
 	m >>= 1;
-	SET_NEGATIVE(0);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	Write(src, m);
 }
 
@@ -1953,8 +3917,7 @@ void wdc65c02::Op_LSR_ACC(uint16_t src)
 	uint8_t m = A;
 	SET_CARRY(m & 0x01);
 	m >>= 1;
-	SET_NEGATIVE(0);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	A = m;
 }
 
@@ -1967,8 +3930,7 @@ void wdc65c02::Op_ORA(uint16_t src)
 {
 	uint8_t m = Read(src);
 	m = A | m;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	A = m;
 }
 
@@ -1980,7 +3942,7 @@ void wdc65c02::Op_PHA(uint16_t src)
 
 void wdc65c02::Op_PHP(uint16_t src)
 {
-	StackPush(status | CONSTANT | BREAK);
+	StackPush(SyncStatus() | CONSTANT | BREAK);
 	return;
 }
 
@@ -1999,103 +3961,39 @@ void wdc65c02::Op_PHY(uint16_t src)
 void wdc65c02::Op_PLA(uint16_t src)
 {
 	A = StackPop();
-	SET_NEGATIVE(A & 0x80);
-	SET_ZERO(!A);
+	SET_NZ(A);
 	return;
 }
 
 void wdc65c02::Op_PLP(uint16_t src)
 {
-	status = StackPop() | CONSTANT | BREAK;
+	LoadStatus(StackPop() | CONSTANT | BREAK);
 	//SET_CONSTANT(1);
+	CheckInterrupts();
 	return;
 }
 
 void wdc65c02::Op_PLX(uint16_t src)
 {
 	X = StackPop();
-	SET_NEGATIVE(X & 0x80);
-	SET_ZERO(!X);
+	SET_NZ(X);
 	return;
 }
 
 void wdc65c02::Op_PLY(uint16_t src)
 {
 	Y = StackPop();
-	SET_NEGATIVE(Y & 0x80);
-	SET_ZERO(!Y);
+	SET_NZ(Y);
 	return;
 }
 
 // RESET MEMORY BIT INSTRUCTIONS
 
-void wdc65c02::Op_RMB0(uint16_t src)
-{
-	uint8_t m = Read(src);
-	m &= 0b11111110;
-	Write(src, m);
-
-	return;
-}
-
-void wdc65c02::Op_RMB1(uint16_t src)
-{
-	uint8_t m = Read(src);
-	m &= 0b11111101;
-	Write(src, m);
-
-	return;
-}
-
-void wdc65c02::Op_RMB2(uint16_t src)
-{
-	uint8_t m = Read(src);
-	m &= 0b11111011;
-	Write(src, m);
-
-	return;
-}
-
-void wdc65c02::Op_RMB3(uint16_t src)
-{
-	uint8_t m = Read(src);
-	m &= 0b11110111;
-	Write(src, m);
-
-	return;
-}
-
-void wdc65c02::Op_RMB4(uint16_t src)
-{
-	uint8_t m = Read(src);
-	m &= 0b11101111;
-	Write(src, m);
-
-	return;
-}
-
-void wdc65c02::Op_RMB5(uint16_t src)
-{
-	uint8_t m = Read(src);
-	m &= 0b11011111;
-	Write(src, m);
-
-	return;
-}
-
-void wdc65c02::Op_RMB6(uint16_t src)
-{
-	uint8_t m = Read(src);
-	m &= 0b10111111;
-	Write(src, m);
-
-	return;
-}
-
-void wdc65c02::Op_RMB7(uint16_t src)
+template<uint8_t bit>
+void wdc65c02::Op_RMB(uint16_t src)
 {
 	uint8_t m = Read(src);
-	m &= 0b01111111;
+	m &= ~(1 << bit);
 	Write(src, m);
 
 	return;
@@ -2108,8 +4006,7 @@ void wdc65c02::Op_ROL(uint16_t src)
 	if (IF_CARRY()) m |= 0x01;
 	SET_CARRY(m > 0xFF);
 	m &= 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	Write(src, m);
 	return;
 }
@@ -2121,8 +4018,7 @@ void wdc65c02::Op_ROL_ACC(uint16_t src)
 	if (IF_CARRY()) m |= 0x01;
 	SET_CARRY(m > 0xFF);
 	m &= 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	A = m;
 	return;
 }
@@ -2134,8 +4030,7 @@ void wdc65c02::Op_ROR(uint16_t src)
 	SET_CARRY(m & 0x01);
 	m >>= 1;
 	m &= 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	Write(src, m);
 	return;
 }
@@ -2147,8 +4042,7 @@ void wdc65c02::Op_ROR_ACC(uint16_t src)
 	SET_CARRY(m & 0x01);
 	m >>= 1;
 	m &= 0xFF;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	A = m;
 	return;
 }
@@ -2157,12 +4051,13 @@ void wdc65c02::Op_RTI(uint16_t src)
 {
 	uint8_t lo, hi;
 
-	status = StackPop() | CONSTANT | BREAK;
+	LoadStatus(StackPop() | CONSTANT | BREAK);
 
 	lo = StackPop();
 	hi = StackPop();
 
 	pc = (hi << 8) | lo;
+	CheckInterrupts();
 	return;
 }
 
@@ -2177,26 +4072,19 @@ void wdc65c02::Op_RTS(uint16_t src)
 	return;
 }
 
+// Same as Op_ADC(), borrowing instead of carrying.
 void wdc65c02::Op_SBC(uint16_t src)
 {
 	uint8_t m = Read(src);
-	unsigned int tmp = A - m - (IF_CARRY() ? 0 : 1);
-	SET_NEGATIVE(tmp & 0x80);
-	SET_ZERO(!(tmp & 0xFF));
-	SET_OVERFLOW(((A ^ tmp) & 0x80) && ((A ^ m) & 0x80));
-
-	if (IF_DECIMAL())
-	{
-		if ( ((A & 0x0F) - (IF_CARRY() ? 0 : 1)) < (m & 0x0F)) tmp -= 6;
-		if (tmp > 0x99)
-		{
-			tmp -= 0x60;
-		}
-		SET_NEGATIVE(tmp & 0x80);
-		SET_ZERO(!(tmp & 0xFF));
-	}
-	SET_CARRY(tmp < 0x100);
-	A = (tmp & 0xFF);
+	int borrow = (status & CARRY) ? 0 : 1;
+	unsigned int decimal = 0U - ((status & DECIMAL) >> 3);
+	unsigned int tmp = A - m - borrow;
+	unsigned int overflow = (A ^ tmp) & (A ^ m) & 0x80;
+	tmp -= 0x06 & decimal & (0U - (((A & 0x0F) - borrow) < (m & 0x0F)));
+	tmp -= 0x60 & decimal & (0U - (tmp > 0x99));
+	status = (status & ~(OVERFLOW | CARRY)) | (overflow >> 1) | (tmp < 0x100);
+	SET_NZ((uint8_t)tmp);
+	A = tmp & 0xFF;
 	return;
 }
 
@@ -2220,73 +4108,11 @@ void wdc65c02::Op_SEI(uint16_t src)
 
 // SET MEMORY BIT INSTRUCTIONS
 
-void wdc65c02::Op_SMB0(uint16_t src)
-{
-	uint8_t m = Read(src);
-	m |= 0b00000001;
-	Write(src, m);
-
-	return;
-}
-
-void wdc65c02::Op_SMB1(uint16_t src)
-{
-	uint8_t m = Read(src);
-	m |= 0b00000010;
-	Write(src, m);
-
-	return;
-}
-
-void wdc65c02::Op_SMB2(uint16_t src)
-{
-	uint8_t m = Read(src);
-	m |= 0b00000100;
-	Write(src, m);
-
-	return;
-}
-
-void wdc65c02::Op_SMB3(uint16_t src)
-{
-	uint8_t m = Read(src);
-	m |= 0b00001000;
-	Write(src, m);
-
-	return;
-}
-
-void wdc65c02::Op_SMB4(uint16_t src)
-{
-	uint8_t m = Read(src);
-	m |= 0b00010000;
-	Write(src, m);
-
-	return;
-}
-
-void wdc65c02::Op_SMB5(uint16_t src)
-{
-	uint8_t m = Read(src);
-	m |= 0b00100000;
-	Write(src, m);
-
-	return;
-}
-
-void wdc65c02::Op_SMB6(uint16_t src)
-{
-	uint8_t m = Read(src);
-	m |= 0b01000000;
-	Write(src, m);
-
-	return;
-}
-
-void wdc65c02::Op_SMB7(uint16_t src)
+template<uint8_t bit>
+void wdc65c02::Op_SMB(uint16_t src)
 {
 	uint8_t m = Read(src);
-	m |= 0b10000000;
+	m |= (1 << bit);
 	Write(src, m);
 
 	return;
@@ -2301,6 +4127,7 @@ void wdc65c02::Op_STA(uint16_t src)
 
 void wdc65c02::Op_STP(uint16_t src)
 {
+	STATS_EVENT(stps);
 	STOP |= 0b00000001;
 	pc--;
 	return;
@@ -2327,8 +4154,7 @@ void wdc65c02::Op_STZ(uint16_t src)
 void wdc65c02::Op_TAX(uint16_t src)
 {
 	uint8_t m = A;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	X = m;
 	return;
 }
@@ -2336,8 +4162,7 @@ void wdc65c02::Op_TAX(uint16_t src)
 void wdc65c02::Op_TAY(uint16_t src)
 {
 	uint8_t m = A;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	Y = m;
 	return;
 }
@@ -2363,8 +4188,7 @@ void wdc65c02::Op_TSB(uint16_t src)
 void wdc65c02::Op_TSX(uint16_t src)
 {
 	uint8_t m = sp;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	X = m;
 	return;
 }
@@ -2372,8 +4196,7 @@ void wdc65c02::Op_TSX(uint16_t src)
 void wdc65c02::Op_TXA(uint16_t src)
 {
 	uint8_t m = X;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	A = m;
 	return;
 }
@@ -2387,15 +4210,16 @@ void wdc65c02::Op_TXS(uint16_t src)
 void wdc65c02::Op_TYA(uint16_t src)
 {
 	uint8_t m = Y;
-	SET_NEGATIVE(m & 0x80);
-	SET_ZERO(!m);
+	SET_NZ(m);
 	A = m;
 	return;
 }
 
 void wdc65c02::Op_WAI(uint16_t src)
 {
+	STATS_EVENT(wais);
 	STOP |= 0b00000010;
 	pc--;
+	CheckInterrupts();
 	return;
 }
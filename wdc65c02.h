@@ -1,6 +1,7 @@
 #pragma once
 #include <stdint.h>
 #include <string.h>
+#include <atomic>
 
 class wdc65c02
 {
@@ -26,19 +27,27 @@ private:
 	// status register
 	uint8_t status;
 
+	// N and Z as the last result that set them, for WDC65C02_LAZY_FLAGS
+	uint8_t nValue;
+	uint8_t zValue;
+
 	typedef void (wdc65c02::*CodeExec)(uint16_t);
 	typedef uint16_t (wdc65c02::*AddrExec)();
 
 	struct Instr
 	{
-		AddrExec addr;
-		CodeExec code;
-		uint8_t cycles;
+		uint8_t code;       // index into CodeTable
+		uint8_t addr : 4;   // index into AddrTable
+		uint8_t cycles : 4;
 	};
+	static_assert(sizeof(Instr) == 2, "decode entries should stay packed");
 
-	static Instr InstrTable[256];
+	static const Instr InstrTable[256];
+	static const AddrExec AddrTable[];
+	static const CodeExec CodeTable[];
 
 	void Exec(Instr i);
+	inline void ExecSwitch(uint8_t opcode);
 
 	// Addressing modes (Arranged according to datasheet)
 	uint16_t Addr_ABSOL(); // ABSOLUTE
@@ -62,22 +71,8 @@ private:
 	void Op_AND(uint16_t src);
 	void Op_ASL(uint16_t src); 	void Op_ASL_ACC(uint16_t src);
 
-	void Op_BBR0(uint16_t src);  // W65C02S INSTRUCTIONS
-	void Op_BBR1(uint16_t src);
-	void Op_BBR2(uint16_t src);
-	void Op_BBR3(uint16_t src);
-	void Op_BBR4(uint16_t src);
-	void Op_BBR5(uint16_t src);
-	void Op_BBR6(uint16_t src);
-	void Op_BBR7(uint16_t src);
-	void Op_BBS0(uint16_t src);  // W65C02S INSTRUCTIONS
-	void Op_BBS1(uint16_t src);
-	void Op_BBS2(uint16_t src);
-	void Op_BBS3(uint16_t src);
-	void Op_BBS4(uint16_t src);
-	void Op_BBS5(uint16_t src);
-	void Op_BBS6(uint16_t src);
-	void Op_BBS7(uint16_t src);
+	template<uint8_t bit> void Op_BBR(uint16_t src);  // W65C02S INSTRUCTIONS
+	template<uint8_t bit> void Op_BBS(uint16_t src);  // W65C02S INSTRUCTIONS
 	
 	void Op_BCC(uint16_t src);
 	void Op_BCS(uint16_t src);
@@ -127,14 +122,7 @@ private:
 	void Op_PLX(uint16_t src);  // W65C02S INSTRUCTION
 	void Op_PLY(uint16_t src);  // W65C02S INSTRUCTION
 	
-	void Op_RMB0(uint16_t src);  // W65C02S INSTRUCTIONS
-	void Op_RMB1(uint16_t src);
-	void Op_RMB2(uint16_t src);
-	void Op_RMB3(uint16_t src);
-	void Op_RMB4(uint16_t src);
-	void Op_RMB5(uint16_t src);
-	void Op_RMB6(uint16_t src);
-	void Op_RMB7(uint16_t src);
+	template<uint8_t bit> void Op_RMB(uint16_t src);  // W65C02S INSTRUCTIONS
 
 	void Op_ROL(uint16_t src); 	void Op_ROL_ACC(uint16_t src);
 	void Op_ROR(uint16_t src);	void Op_ROR_ACC(uint16_t src);
@@ -146,14 +134,7 @@ private:
 	void Op_SED(uint16_t src);
 	void Op_SEI(uint16_t src);
 	
-	void Op_SMB0(uint16_t src);  // W65C02S INSTRUCTIONS
-	void Op_SMB1(uint16_t src);
-	void Op_SMB2(uint16_t src);
-	void Op_SMB3(uint16_t src);
-	void Op_SMB4(uint16_t src);
-	void Op_SMB5(uint16_t src);
-	void Op_SMB6(uint16_t src);
-	void Op_SMB7(uint16_t src);
+	template<uint8_t bit> void Op_SMB(uint16_t src);  // W65C02S INSTRUCTIONS
 
 	void Op_STA(uint16_t src);
 	void Op_STP(uint16_t src);  // W65C02S INSTRUCTION
@@ -180,33 +161,220 @@ private:
 	static const uint16_t nmiVectorL = 0xFFFA;
 
 	// STP, WAI
-	uint8_t STOP; // BIT 0 = STP, BIT 1 = WAI
+	// Members written by other threads (interrupt lines). Copyable, so
+	// Fork() can still copy the whole object.
+	template<typename T> struct Atomic : std::atomic<T>
+	{
+		Atomic() {}
+		Atomic(T value) : std::atomic<T>(value) {}
+		Atomic(const Atomic& other) : std::atomic<T>(other.load()) {}
+		using std::atomic<T>::operator=;
+	};
+
+	Atomic<uint8_t> STOP; // BIT 0 = STP, BIT 1 = WAI, BIT 2 = interrupt to take
+
+	// interrupt inputs, sampled by Run() between instructions
+	Atomic<uint32_t> irqLines; // one bit per source, wired-OR
+	Atomic<uint8_t> nmiLine;
+	Atomic<uint8_t> nmiLatch;  // NMI asserted since it was last taken
+	Atomic<uint8_t> traceLines; // tracing, the line setters may not read tracer
+	inline void CheckInterrupts();
+	void TakeInterrupts();
+
+	// dispatch engine used by Run()
+	uint8_t dispatch;
+
+	// idle fast-forward, see SetIdleSkip()
+	uint8_t idleSkip;
+	uint64_t idleCycles;
+	uint32_t busReads; // reads through the callbacks
 
 	// read/write callbacks
 	typedef void (*BusWrite)(uint16_t, uint8_t);
 	typedef uint8_t (*BusRead)(uint16_t);
-	BusRead Read;
-	BusWrite Write;
+	BusRead busRead;
+	BusWrite busWrite;
+
+	// read/write callbacks with a user context, used instead when set
+	typedef void (*BusWriteCtx)(void*, uint16_t, uint8_t);
+	typedef uint8_t (*BusReadCtx)(void*, uint16_t);
+	BusReadCtx busReadCtx;
+	BusWriteCtx busWriteCtx;
+	void* busContext;
+
+	// page map, one entry per 256-byte page
+	// NULL sends the access to the callbacks
+	const uint8_t* readPage[256];
+	uint8_t* writePage[256];
+
+	// PAGE_RAM, PAGE_COW and PAGE_CODE bits, a write to a page whose
+	// writePage is NULL checks them before going to the callback
+	uint8_t pageFlags[256];
+	uint8_t* WriteTrap(uint8_t page);
+
+	// copy-on-write pages, shared between forked instances
+	struct SharedPage;
+	SharedPage* ownedPage[256]; // page memory allocated by the emulator
+	void CopyPage(uint8_t page);
+	void ReleasePage(uint8_t page);
+
+	// memory access
+	inline uint8_t Read(uint16_t address);
+	inline void Write(uint16_t address, uint8_t value);
 
 	// stack operations
 	inline void StackPush(uint8_t byte);
 	inline uint8_t StackPop();
 
+	// whole status register, see WDC65C02_LAZY_FLAGS
+	inline uint8_t SyncStatus();
+	inline void LoadStatus(uint8_t value);
+
+	inline void Compare(uint8_t reg, uint8_t m);
+
+	// copies are made with Fork() only
+	wdc65c02(const wdc65c02&) = default;
+	wdc65c02& operator=(const wdc65c02&) = delete;
+
 
 public:
 	enum CycleMethod {
 		INST_COUNT,
 		CYCLE_COUNT,
 	};
+	enum DispatchMethod {
+		TABLE_DISPATCH,   // InstrTable member pointers
+		SWITCH_DISPATCH,  // one inlined case per opcode
+		BLOCK_DISPATCH,   // cached predecoded basic blocks, with WDC65C02_BLOCKS
+		TRACE_DISPATCH,   // blocks, hot ones translated into traces, ditto
+	};
 	wdc65c02(BusRead r, BusWrite w);
+	wdc65c02(BusReadCtx r, BusWriteCtx w, void* context);
+	~wdc65c02();
+	wdc65c02* Fork();
 	void NMI();
 	void IRQ();
 	void Reset();
+	void SetIRQLine(uint32_t sources, bool asserted);
+	uint32_t GetIRQLines();
+	void SetNMILine(bool asserted);
+	bool GetNMILine();
+	bool GetPendingInterrupt();
 	void Run(
 		int32_t cycles,
 		uint64_t& cycleCount,
 		CycleMethod cycleMethod = CYCLE_COUNT);
 
+	void SetDispatch(DispatchMethod method);
+	DispatchMethod GetDispatch();
+
+	void SetIdleSkip(bool enable);
+	bool GetIdleSkip();
+	uint64_t GetIdleCycles();
+
+	// events, called back by Run() once cycleCount reaches their cycle
+	typedef void (*EventCallback)(void* context, uint64_t cycle);
+	uint32_t Schedule(uint64_t cycle, EventCallback callback, void* context);
+	bool Cancel(uint32_t event);
+	uint64_t GetNextEvent();
+
+	void MapRAM(uint16_t address, uint32_t size, uint8_t* memory);
+	void MapROM(uint16_t address, uint32_t size, const uint8_t* memory);
+	void MapBus(uint16_t address, uint32_t size);
+
+	uint8_t Peek(uint16_t address);
+	void Poke(uint16_t address, uint8_t value);
+
+	void FlushBlockCache();
+
+	void* GetBusContext();
+	void SetBusContext(void* context);
+
+	// opcode pairs and triples as executed, see wdc65c02_fusegen.py
+	struct Ngram
+	{
+		uint8_t length; // 2 or 3
+		uint8_t opcode[3];
+		uint64_t count;
+	};
+	void SetProfiling(bool enable);
+	bool GetProfiling();
+	void ClearProfile();
+	uint64_t GetPairCount(uint8_t first, uint8_t second);
+	uint64_t GetTripleCount(uint8_t first, uint8_t second, uint8_t third);
+	size_t GetProfile(Ngram* ngrams, size_t max);
+
+	// cycles by routine and call stack, exported as folded stacks
+	void SetCallProfiling(bool enable, uint32_t samplePeriod = 0);
+	bool GetCallProfiling();
+	void ClearCallProfile();
+	// needs SetCallProfiling(true) first, returns 0 otherwise; turning
+	// call profiling off drops the labels
+	size_t LoadLabels(const char* text);
+	uint64_t GetPCCycles(uint16_t address);
+	size_t GetFoldedStacks(char* buffer, size_t size);
+
+	// binary instruction trace, Run() fills the blocks of a ring that
+	// another thread drains, see wdc65c02_trace.h
+	static const uint32_t TRACE_MAGIC = 0x31525457; // "WTR1"
+	enum TraceMode {
+		TRACE_INSTRUCTIONS, // every instruction with its registers
+		TRACE_BRANCHES,     // control transfers only
+	};
+	struct TraceBlock
+	{
+		uint32_t magic;
+		uint32_t bytes;   // whole block, this header included
+		uint32_t records;
+		uint32_t lost;    // records dropped before this block, ring full
+		uint64_t cycle;   // of the first record
+		uint8_t kind;     // TraceMode
+		uint8_t reserved[7];
+	};
+	static_assert(sizeof(TraceBlock) == 32, "trace files depend on the header layout");
+	struct TraceRing
+	{
+		uint8_t* blocks;            // count blocks of blockSize bytes
+		uint32_t count;
+		uint32_t blockSize;
+		std::atomic<uint32_t> head; // blocks filled, advanced by Run()
+		std::atomic<uint32_t> tail; // blocks drained, advanced by the reader
+		std::atomic<uint64_t> lost; // records dropped in all
+	};
+	void SetTraceRing(TraceRing* ring, TraceMode mode = TRACE_INSTRUCTIONS);
+	TraceRing* GetTraceRing();
+	void FlushTrace();
+
+	// execution counters, compiled in with WDC65C02_STATS
+	enum AddressingMode {
+		MODE_ABSOL, MODE_ABIXN, MODE_ABSIX, MODE_ABSIY, MODE_ABSIN,
+		MODE_ACCUM, MODE_IMMED, MODE_IMPLI, MODE_RELAT, MODE_ZEROP,
+		MODE_ZPIXN, MODE_ZRPIX, MODE_ZRPIY, MODE_ZRPIN, MODE_ZPINY,
+		MODE_COUNT
+	};
+	struct Stats
+	{
+		uint64_t opcodes[256];      // instructions executed, by opcode
+		uint64_t cycles[256];       // cycles they took, by opcode
+		uint64_t modes[MODE_COUNT]; // instructions executed, by addressing mode
+		uint64_t irqs;              // interrupts taken
+		uint64_t nmis;
+		uint64_t wais;              // WAI and STP executed
+		uint64_t stps;
+	};
+	bool GetStats(Stats* stats);
+	void ClearStats();
+
+	// decoding, for tools reading traces
+	static uint8_t InstrLength(uint8_t opcode); // bytes, opcode included
+	static AddressingMode InstrMode(uint8_t opcode);
+	static uint8_t InstrCycles(uint8_t opcode);
+	static bool InstrWrites(uint8_t opcode);    // memory, the stack included
+
+	size_t GetStateSize();
+	size_t SaveState(uint8_t* buffer, size_t size);
+	bool LoadState(const uint8_t* buffer, size_t size);
+
     uint16_t GetPC();
     uint8_t GetS();
     uint8_t GetP();
@@ -232,4 +400,69 @@ public:
     uint8_t GetResetA();
     uint8_t GetResetX();
     uint8_t GetResetY();
-};
+
+private:
+	// predecoded basic blocks, direct mapped by start address
+	struct Block;
+	Block* blocks;
+	uint32_t blockEpoch; // incremented whenever blocks are invalidated
+	Block* GetBlock(uint16_t address);
+	void InvalidatePage(uint8_t page);
+	void RunBlocks(
+		int32_t& cyclesRemaining,
+		uint64_t& cycleCount,
+		CycleMethod cycleMethod);
+	static bool InstrEndsBlock(uint8_t opcode);
+	inline uint64_t IdleState();
+	inline void SkipIdle(
+		int32_t& cyclesRemaining,
+		uint64_t& cycleCount,
+		CycleMethod cycleMethod,
+		uint16_t cycles,
+		uint8_t count);
+	void RunLoop(
+		int32_t& cyclesRemaining,
+		uint64_t& cycleCount,
+		CycleMethod cycleMethod);
+
+	// hot blocks translated into traces with resolved operands
+	struct Trace;
+	Trace* traces;
+	void BuildTrace(uint16_t address);
+	static void FuseTrace(Trace* trace);
+	inline void ExecResolved(uint8_t opcode, uint16_t operand);
+	inline uint8_t ExecFused(const Trace* trace, uint8_t i);
+
+	// pending events, NULL until the first Schedule()
+	struct Scheduler;
+	Scheduler* events;
+	void FireEvents(uint64_t cycle);
+
+	// opcode n-gram histogram, NULL unless profiling
+	struct Profile;
+	Profile* profile;
+	void RunProfiled(
+		int32_t& cyclesRemaining,
+		uint64_t& cycleCount,
+		CycleMethod cycleMethod);
+
+	// call stacks, NULL unless call profiling
+	struct CallProfile;
+	CallProfile* calls;
+	void CountCall(uint16_t address, uint8_t opcode, uint8_t cycles);
+	void EnterCall(uint16_t address, uint8_t before);
+	void ReturnCall();
+	void EnterInterrupt();
+	static void SampleCalls(void* context, uint64_t cycle);
+
+	// instruction trace, NULL unless tracing
+	struct Tracer;
+	Tracer* tracer;
+	void TraceInstr(uint64_t cycle, uint16_t address, uint8_t opcode);
+	void TraceEntry(uint64_t cycle, uint16_t address);
+	void TraceBranch(uint64_t cycle, uint16_t address, uint8_t opcode);
+	void TraceLines(uint64_t cycle);
+
+	// execution counters, NULL unless built with WDC65C02_STATS
+	Stats* stats;
+};
\ No newline at end of file
@@ -0,0 +1,713 @@
+// Offline analysis of the trace files wdc65c02_trace writes. The file is
+// mapped into memory and split at block boundaries into one shard per
+// thread. Every block decodes on its own, so the shards are worked through
+// in parallel and only their results are merged, in file order. Reports:
+//
+//   hot instructions   executions and cycles by address
+//   routines           cycles by routine, a routine being the code from an
+//                      entry point (JSR target, interrupt handler) up to the
+//                      next one
+//   memory             reads and writes by page and by address, for the
+//                      operands the trace gives the address of
+//   interrupt latency  cycles from an interrupt line being raised to the
+//                      first instruction of the handler
+//
+// There is no build file, compile it together with the core:
+//
+//   g++ -O2 -std=c++11 wdc65c02_analyze.cpp wdc65c02.cpp wdc65c02_trace.cpp
+//     -o wdc65c02_analyze -lpthread
+//
+// usage: wdc65c02_analyze [-j threads] [-n top] [-m memory] trace
+//
+// A TRACE_BRANCHES trace needs -m, a 64 KB image of the memory holding the
+// code, to walk its path with. Its cycles are those of InstrCycles() for
+// the instructions walked, and it has no registers, so memory accesses are
+// left out. Interrupt latency needs the lines to be raised with
+// SetIRQLine() and SetNMILine(). Uses mmap(), so POSIX only.
+
+#include "wdc65c02.h"
+#include "wdc65c02_trace.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <thread>
+#include <vector>
+
+typedef wdc65c02_trace::Record Record;
+
+// The latency of one kind of interrupt, followed through the line changes
+// and interrupt entries. A shard starts out not knowing whether the line is
+// up or an interrupt is waiting; the records until it does are kept in head
+// and played again at merge, on the state the shard before ended in.
+struct Latency
+{
+	enum { ENTRY = -1, LOST = -2 };
+
+	bool latched;      // NMI, taken once per rising edge
+	bool levelKnown;
+	bool pendingKnown;
+	bool high;         // line asserted
+	bool pending;      // raised, not taken yet
+	uint64_t since;    // cycle it was raised
+	std::vector<std::pair<uint64_t, int> > head; // cycle, line level or the above
+	std::map<uint64_t, uint64_t> counts;         // times seen, by latency
+
+	Latency(bool latched)
+		: latched(latched)
+		, levelKnown(false)
+		, pendingKnown(false)
+		, high(false)
+		, pending(false)
+		, since(0)
+	{
+	}
+
+	void Event(uint64_t cycle, int what, bool keep)
+	{
+		if (keep && !(levelKnown && pendingKnown))
+		{
+			// entries after the first one don't change anything
+			if (what != ENTRY || head.empty() || head.back().second != ENTRY) head.push_back(std::make_pair(cycle, what));
+		}
+
+		if (what == LOST)
+		{
+			levelKnown = false;
+			pendingKnown = false;
+		}
+		else if (what == ENTRY)
+		{
+			if (pendingKnown && pending) counts[cycle - since]++;
+			pending = false;
+			pendingKnown = true;
+		}
+		else
+		{
+			if (levelKnown && !high && what)
+			{
+				if (!(pendingKnown && pending)) since = cycle;
+				pending = true;
+				pendingKnown = true;
+			}
+			else if (!what && !latched)
+			{
+				pending = false;
+				pendingKnown = true;
+			}
+			high = what != 0;
+			levelKnown = true;
+		}
+	}
+
+	// continues from the end of the shard before, then takes over this
+	// one's state if it got to know it
+	void Merge(const Latency& next)
+	{
+		for (size_t i = 0; i < next.head.size(); i++) Event(next.head[i].first, next.head[i].second, false);
+		if (next.levelKnown && next.pendingKnown)
+		{
+			levelKnown = pendingKnown = true;
+			high = next.high;
+			pending = next.pending;
+			since = next.since;
+		}
+		for (std::map<uint64_t, uint64_t>::const_iterator it = next.counts.begin(); it != next.counts.end(); ++it)
+		{
+			counts[it->first] += it->second;
+		}
+	}
+};
+
+struct Shard
+{
+	size_t begin;              // bytes of the file
+	size_t end;
+
+	uint64_t counts[0x10000];  // instructions executed, by address
+	uint64_t cycles[0x10000];  // spent there
+	uint64_t reads[0x10000];
+	uint64_t writes[0x10000];
+	uint8_t entries[0x10000];  // JSR targets and interrupt handlers
+
+	uint64_t instructions;
+	uint64_t records;
+	uint64_t lost;
+	uint64_t irqs;
+	uint64_t nmis;
+	uint64_t unresolved;       // accesses through pointers
+	uint64_t walkFailures;
+	bool branches;             // walked, without registers
+	bool needsMemory;          // branch records without -m
+	bool failed;
+
+	// in an instruction trace, the time from the last instruction to the
+	// first record of the next shard is charged to it
+	bool joined;               // nothing lost before the first record
+	bool started;
+	Record first;              // that record
+	bool open;
+	uint16_t openPC;
+	uint64_t openCycle;
+
+	uint8_t entering;          // 1 after BRK, 2 after an interrupt
+	Latency irq;
+	Latency nmi;
+
+	wdc65c02_trace::Walker* walker;
+	std::vector<uint16_t> path;
+
+	Shard(size_t begin, size_t end)
+		: begin(begin)
+		, end(end)
+		, instructions(0)
+		, records(0)
+		, lost(0)
+		, irqs(0)
+		, nmis(0)
+		, unresolved(0)
+		, walkFailures(0)
+		, branches(false)
+		, needsMemory(false)
+		, failed(false)
+		, joined(false)
+		, started(false)
+		, open(false)
+		, entering(0)
+		, irq(false)
+		, nmi(true)
+		, walker(NULL)
+	{
+		memset(counts, 0, sizeof(counts));
+		memset(cycles, 0, sizeof(cycles));
+		memset(reads, 0, sizeof(reads));
+		memset(writes, 0, sizeof(writes));
+		memset(entries, 0, sizeof(entries));
+	}
+
+	~Shard()
+	{
+		delete walker;
+	}
+};
+
+// Instructions that write their operand without reading it.
+static bool Stores(uint8_t opcode)
+{
+	switch (opcode)
+	{
+	case 0x81: case 0x85: case 0x8D: case 0x91: case 0x92: case 0x95: case 0x99: case 0x9D: // STA
+	case 0x86: case 0x8E: case 0x96: // STX
+	case 0x84: case 0x8C: case 0x94: // STY
+	case 0x64: case 0x74: case 0x9C: case 0x9E: // STZ
+		return true;
+	}
+	return false;
+}
+
+// The memory an instruction touches, worked out from its operands and the
+// registers it starts with.
+static void Access(Shard* shard, const Record& r)
+{
+	uint8_t zp = r.operand[0];
+	uint16_t absolute = r.operand[0] | (r.operand[1] << 8);
+	uint16_t address;
+
+	switch (r.opcode)
+	{
+	case 0x08: case 0x48: case 0x5A: case 0xDA: // PHP, PHA, PHY, PHX
+		shard->writes[0x100 | r.s]++;
+		return;
+	case 0x28: case 0x68: case 0x7A: case 0xFA: // PLP, PLA, PLY, PLX
+		shard->reads[0x100 | (uint8_t)(r.s + 1)]++;
+		return;
+	case 0x20: // JSR
+		for (int i = 0; i < 2; i++) shard->writes[0x100 | (uint8_t)(r.s - i)]++;
+		return;
+	case 0x00: // BRK
+		for (int i = 0; i < 3; i++) shard->writes[0x100 | (uint8_t)(r.s - i)]++;
+		shard->reads[0xFFFE]++;
+		shard->reads[0xFFFF]++;
+		return;
+	case 0x60: // RTS
+		for (int i = 1; i <= 2; i++) shard->reads[0x100 | (uint8_t)(r.s + i)]++;
+		return;
+	case 0x40: // RTI
+		for (int i = 1; i <= 3; i++) shard->reads[0x100 | (uint8_t)(r.s + i)]++;
+		return;
+	case 0x4C: // JMP
+		return;
+	}
+
+	switch (wdc65c02::InstrMode(r.opcode))
+	{
+	case wdc65c02::MODE_ZEROP: address = zp; break;
+	case wdc65c02::MODE_ZRPIX: address = (uint8_t)(zp + r.x); break;
+	case wdc65c02::MODE_ZRPIY: address = (uint8_t)(zp + r.y); break;
+	case wdc65c02::MODE_ABSOL: address = absolute; break;
+	case wdc65c02::MODE_ABSIX: address = absolute + r.x; break;
+	case wdc65c02::MODE_ABSIY: address = absolute + r.y; break;
+	case wdc65c02::MODE_ZPIXN:
+		zp += r.x;
+		// fall through
+	case wdc65c02::MODE_ZRPIN:
+	case wdc65c02::MODE_ZPINY:
+		// the pointer is read, what it points at isn't in the trace
+		shard->reads[zp]++;
+		shard->reads[(uint8_t)(zp + 1)]++;
+		shard->unresolved++;
+		return;
+	case wdc65c02::MODE_ABIXN:
+		absolute += r.x;
+		// fall through
+	case wdc65c02::MODE_ABSIN:
+		shard->reads[absolute]++;
+		shard->reads[(uint16_t)(absolute + 1)]++;
+		return;
+	default:
+		return;
+	}
+
+	if (!Stores(r.opcode)) shard->reads[address]++;
+	if (wdc65c02::InstrWrites(r.opcode)) shard->writes[address]++;
+}
+
+// Charges the time from the last instruction up to cycle to it.
+static void Close(Shard* shard, uint64_t cycle)
+{
+	if (shard->open) shard->cycles[shard->openPC] += cycle - shard->openCycle;
+	shard->open = false;
+}
+
+static void Instruction(Shard* shard, const Record& r)
+{
+	Close(shard, r.cycle);
+	shard->open = true;
+	shard->openPC = r.pc;
+	shard->openCycle = r.cycle;
+
+	shard->counts[r.pc]++;
+	shard->instructions++;
+	if (r.opcode == 0x20) shard->entries[r.operand[0] | (r.operand[1] << 8)] = 1;
+	if (shard->entering)
+	{
+		shard->entries[r.pc] = 1;
+		// the interrupt pushed pc and P, BRK counts its own
+		if (shard->entering == 2)
+		{
+			for (int i = 1; i <= 3; i++) shard->writes[0x100 | (uint8_t)(r.s + i)]++;
+		}
+		shard->entering = 0;
+	}
+	if (r.opcode == 0x00) shard->entering = 1;
+	Access(shard, r);
+}
+
+static void Walked(Shard* shard, const std::vector<uint16_t>& path, const uint8_t* memory)
+{
+	for (size_t i = 0; i < path.size(); i++)
+	{
+		shard->counts[path[i]]++;
+		shard->cycles[path[i]] += wdc65c02::InstrCycles(memory[path[i]]);
+	}
+	shard->instructions += path.size();
+}
+
+// A record of a TRACE_BRANCHES trace.
+static void Transfer(Shard* shard, const Record& r, const uint8_t* memory)
+{
+	if (!shard->walker)
+	{
+		shard->needsMemory = true;
+		return;
+	}
+
+	shard->branches = true;
+	shard->path.clear();
+	if (!shard->walker->Walk(r, shard->path)) shard->walkFailures++;
+	Walked(shard, shard->path, memory);
+
+	if (r.type == wdc65c02_trace::RECORD_CALL || r.type == wdc65c02_trace::RECORD_BRK ||
+		r.type == wdc65c02_trace::RECORD_IRQ || r.type == wdc65c02_trace::RECORD_NMI)
+	{
+		shard->entries[shard->walker->GetPC()] = 1;
+	}
+}
+
+static void Analyze(Shard* shard, const uint8_t* data, const uint8_t* memory)
+{
+	if (memory) shard->walker = new wdc65c02_trace::Walker(memory);
+
+	wdc65c02_trace::Reader reader(data + shard->begin, shard->end - shard->begin);
+	Record r;
+	while (reader.Next(r))
+	{
+		shard->records++;
+		// what the shard before runs up to
+		if (r.type != wdc65c02_trace::RECORD_LINES && !shard->started)
+		{
+			shard->started = true;
+			shard->joined = r.type != wdc65c02_trace::RECORD_LOST;
+			shard->first = r;
+		}
+
+		switch (r.type)
+		{
+		case wdc65c02_trace::RECORD_INSTR:
+			Instruction(shard, r);
+			break;
+		case wdc65c02_trace::RECORD_LOST:
+			shard->lost += r.lost;
+			shard->open = false;
+			shard->entering = 0;
+			shard->irq.Event(r.cycle, Latency::LOST, true);
+			shard->nmi.Event(r.cycle, Latency::LOST, true);
+			if (shard->walker) shard->walker->Walk(r, shard->path);
+			break;
+		case wdc65c02_trace::RECORD_LINES:
+			// either may not have changed, that's no edge
+			shard->irq.Event(r.cycle, r.irqLines != 0, true);
+			shard->nmi.Event(r.cycle, r.nmiLine != 0, true);
+			break;
+		case wdc65c02_trace::RECORD_IRQ:
+		case wdc65c02_trace::RECORD_NMI:
+			if (r.type == wdc65c02_trace::RECORD_IRQ)
+			{
+				shard->irqs++;
+				shard->irq.Event(r.cycle, Latency::ENTRY, true);
+			}
+			else
+			{
+				shard->nmis++;
+				shard->nmi.Event(r.cycle, Latency::ENTRY, true);
+			}
+			// the handler's first instruction follows in an instruction
+			// trace, the record has the addresses in a branch trace
+			if (r.direct) shard->entering = 2;
+			else Transfer(shard, r, memory);
+			break;
+		default:
+			Transfer(shard, r, memory);
+		}
+	}
+	shard->failed = reader.Failed();
+}
+
+// Adds shard b, which follows a in the file, to a.
+static void Merge(Shard* a, Shard* b, const uint8_t* memory)
+{
+	if (b->joined && a->walker && b->first.type == wdc65c02_trace::RECORD_SYNC)
+	{
+		// the code between a's last transfer and b's first record
+		a->path.clear();
+		a->walker->Walk(b->first, a->path);
+		Walked(a, a->path, memory);
+	}
+	if (b->joined) Close(a, b->first.cycle);
+
+	for (int i = 0; i < 0x10000; i++)
+	{
+		a->counts[i] += b->counts[i];
+		a->cycles[i] += b->cycles[i];
+		a->reads[i] += b->reads[i];
+		a->writes[i] += b->writes[i];
+		a->entries[i] |= b->entries[i];
+	}
+	a->instructions += b->instructions;
+	a->records += b->records;
+	a->lost += b->lost;
+	a->irqs += b->irqs;
+	a->nmis += b->nmis;
+	a->unresolved += b->unresolved;
+	a->walkFailures += b->walkFailures;
+	a->branches |= b->branches;
+	a->needsMemory |= b->needsMemory;
+	a->failed |= b->failed;
+	a->irq.Merge(b->irq);
+	a->nmi.Merge(b->nmi);
+
+	std::swap(a->walker, b->walker);
+	a->open = b->open;
+	a->openPC = b->openPC;
+	a->openCycle = b->openCycle;
+}
+
+// The addresses with the largest values, largest first.
+static std::vector<uint32_t> Top(const uint64_t* values, size_t count, size_t n)
+{
+	std::vector<uint32_t> order;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (values[i]) order.push_back((uint32_t)i);
+	}
+	n = std::min(n, order.size());
+	std::partial_sort(order.begin(), order.begin() + n, order.end(),
+		[values](uint32_t x, uint32_t y) { return values[x] > values[y]; });
+	order.resize(n);
+	return order;
+}
+
+static double Percent(uint64_t part, uint64_t whole)
+{
+	return whole ? 100.0 * part / whole : 0.0;
+}
+
+static void PrintLatency(const char* name, const Latency& latency)
+{
+	uint64_t n = 0;
+	uint64_t sum = 0;
+	for (std::map<uint64_t, uint64_t>::const_iterator it = latency.counts.begin(); it != latency.counts.end(); ++it)
+	{
+		n += it->second;
+		sum += it->first * it->second;
+	}
+	if (!n)
+	{
+		printf("  %-4s none measured\n", name);
+		return;
+	}
+
+	// percentiles, and a histogram in powers of two
+	const double points[] = {0.5, 0.9, 0.99};
+	uint64_t at[3] = {0, 0, 0};
+	uint64_t buckets[65] = {0};
+	uint64_t seen = 0;
+	for (std::map<uint64_t, uint64_t>::const_iterator it = latency.counts.begin(); it != latency.counts.end(); ++it)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			if (seen < points[i] * n && seen + it->second >= points[i] * n) at[i] = it->first;
+		}
+		seen += it->second;
+		int bucket = 0;
+		while (bucket < 64 && (it->first >> bucket) > 1) bucket++;
+		buckets[it->first ? bucket + 1 : 0] += it->second;
+	}
+
+	printf("  %-4s %llu taken, min %llu mean %.1f p50 %llu p90 %llu p99 %llu max %llu\n", name,
+		(unsigned long long)n, (unsigned long long)latency.counts.begin()->first, (double)sum / n,
+		(unsigned long long)at[0], (unsigned long long)at[1], (unsigned long long)at[2],
+		(unsigned long long)latency.counts.rbegin()->first);
+	for (int b = 0; b < 65; b++)
+	{
+		if (!buckets[b]) continue;
+		uint64_t low = b ? 1ULL << (b - 1) : 0;
+		uint64_t high = b ? (low << 1) - 1 : 0;
+		char range[48];
+		snprintf(range, sizeof(range), "%llu-%llu", (unsigned long long)low, (unsigned long long)high);
+		printf("       %-14s %10llu  %5.1f%%\n", range, (unsigned long long)buckets[b], Percent(buckets[b], n));
+	}
+}
+
+int main(int argc, char** argv)
+{
+	unsigned threads = std::thread::hardware_concurrency();
+	size_t top = 20;
+	const char* memoryPath = NULL;
+	const char* path = NULL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-j") && i + 1 < argc) threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-n") && i + 1 < argc) top = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-m") && i + 1 < argc) memoryPath = argv[++i];
+		else if (!path && argv[i][0] != '-') path = argv[i];
+		else
+		{
+			path = NULL;
+			break;
+		}
+	}
+	if (!path)
+	{
+		fprintf(stderr, "usage: wdc65c02_analyze [-j threads] [-n top] [-m memory] trace\n");
+		return 2;
+	}
+	if (threads == 0) threads = 1;
+
+	static uint8_t memory[0x10000];
+	if (memoryPath)
+	{
+		FILE* file = fopen(memoryPath, "rb");
+		if (!file)
+		{
+			fprintf(stderr, "can't read %s\n", memoryPath);
+			return 2;
+		}
+		size_t read = fread(memory, 1, sizeof(memory), file);
+		fclose(file);
+		if (read != sizeof(memory))
+		{
+			fprintf(stderr, "%s is not a 64 KB memory image\n", memoryPath);
+			return 2;
+		}
+	}
+
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0)
+	{
+		fprintf(stderr, "can't read %s\n", path);
+		return 2;
+	}
+	size_t size = st.st_size;
+	const uint8_t* data = NULL;
+	if (size)
+	{
+		void* mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapped == MAP_FAILED)
+		{
+			fprintf(stderr, "can't map %s\n", path);
+			return 2;
+		}
+		data = (const uint8_t*)mapped;
+		madvise(mapped, size, MADV_SEQUENTIAL);
+	}
+	close(fd);
+
+	// the blocks, from one header to the next
+	std::vector<size_t> blocks;
+	size_t offset = 0;
+	while (size - offset >= sizeof(wdc65c02::TraceBlock))
+	{
+		wdc65c02::TraceBlock header;
+		memcpy(&header, data + offset, sizeof(header));
+		if (header.magic != wdc65c02::TRACE_MAGIC || header.bytes < sizeof(header) || header.bytes > size - offset) break;
+		blocks.push_back(offset);
+		offset += header.bytes;
+	}
+	size_t used = offset;
+
+	// about the same number of bytes for each thread
+	std::vector<Shard*> shards;
+	size_t next = 0;
+	for (unsigned t = 0; t < threads && next < blocks.size(); t++)
+	{
+		size_t limit = used / threads * (t + 1);
+		size_t b = next + 1;
+		while (b < blocks.size() && (blocks[b] < limit || t == threads - 1)) b++;
+
+		shards.push_back(new Shard(blocks[next], b < blocks.size() ? blocks[b] : used));
+		next = b;
+	}
+
+	std::vector<std::thread> running;
+	for (size_t i = 0; i < shards.size(); i++)
+	{
+		running.push_back(std::thread(Analyze, shards[i], data, memoryPath ? memory : NULL));
+	}
+	for (size_t i = 0; i < running.size(); i++) running[i].join();
+
+	if (shards.empty())
+	{
+		fprintf(stderr, "%s holds no trace blocks\n", path);
+		return 1;
+	}
+	Shard* all = shards[0];
+	// and where the trace starts
+	if (all->started && all->first.type == wdc65c02_trace::RECORD_INSTR) all->entries[all->first.pc] = 1;
+	if (all->started && all->first.type == wdc65c02_trace::RECORD_SYNC) all->entries[all->first.target] = 1;
+	for (size_t i = 1; i < shards.size(); i++) Merge(all, shards[i], memory);
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+	uint64_t cycles = 0;
+	for (int i = 0; i < 0x10000; i++) cycles += all->cycles[i];
+
+	printf("%s: %zu blocks, %.1f MB, %u threads, %.2f s (%.0f MB/s)\n", path, blocks.size(), used / 1e6,
+		(unsigned)shards.size(), seconds, used / 1e6 / seconds);
+	printf("%llu records, %llu instructions, %llu cycles, %llu IRQ, %llu NMI, %llu records lost\n",
+		(unsigned long long)all->records, (unsigned long long)all->instructions, (unsigned long long)cycles,
+		(unsigned long long)all->irqs, (unsigned long long)all->nmis, (unsigned long long)all->lost);
+	if (used < size || all->failed) printf("damaged after byte %zu, the rest is left out\n", used);
+	if (all->needsMemory) printf("branch records left out, walking them needs -m\n");
+	if (all->walkFailures) printf("%llu transfers the code doesn't lead to\n", (unsigned long long)all->walkFailures);
+
+	printf("\nhot instructions\n  address      executed       %%        cycles       %%\n");
+	std::vector<uint32_t> hot = Top(all->cycles, 0x10000, top);
+	for (size_t i = 0; i < hot.size(); i++)
+	{
+		uint32_t a = hot[i];
+		printf("  $%04X   %12llu  %5.1f%%  %12llu  %5.1f%%\n", a, (unsigned long long)all->counts[a],
+			Percent(all->counts[a], all->instructions), (unsigned long long)all->cycles[a], Percent(all->cycles[a], cycles));
+	}
+
+	// every address goes to the closest entry point at or below it
+	std::vector<uint64_t> routineCycles(0x10000);
+	std::vector<uint64_t> routineCounts(0x10000);
+	int32_t entry = -1;
+	uint64_t before = 0;
+	for (int i = 0; i < 0x10000; i++)
+	{
+		if (all->entries[i]) entry = i;
+		if (entry < 0)
+		{
+			before += all->cycles[i];
+			continue;
+		}
+		routineCycles[entry] += all->cycles[i];
+		routineCounts[entry] += all->counts[i];
+	}
+	printf("\nroutines, by entry point\n  entry        cycles       %%      executed\n");
+	std::vector<uint32_t> routines = Top(routineCycles.data(), 0x10000, top);
+	for (size_t i = 0; i < routines.size(); i++)
+	{
+		uint32_t a = routines[i];
+		printf("  $%04X   %12llu  %5.1f%%  %12llu\n", a, (unsigned long long)routineCycles[a],
+			Percent(routineCycles[a], cycles), (unsigned long long)routineCounts[a]);
+	}
+	if (before) printf("  below the lowest entry point %llu cycles\n", (unsigned long long)before);
+
+	std::vector<uint64_t> accesses(0x10000);
+	uint64_t pages[0x100] = {0};
+	uint64_t total = 0;
+	for (int i = 0; i < 0x10000; i++)
+	{
+		accesses[i] = all->reads[i] + all->writes[i];
+		pages[i >> 8] += accesses[i];
+		total += accesses[i];
+	}
+	if (total)
+	{
+		printf("\nmemory pages, %llu accesses, %llu more through pointers\n  page         reads        writes       %%\n",
+			(unsigned long long)total, (unsigned long long)all->unresolved);
+		std::vector<uint32_t> busy = Top(pages, 0x100, top);
+		for (size_t i = 0; i < busy.size(); i++)
+		{
+			uint64_t reads = 0;
+			uint64_t writes = 0;
+			for (int k = 0; k < 0x100; k++)
+			{
+				reads += all->reads[(busy[i] << 8) | k];
+				writes += all->writes[(busy[i] << 8) | k];
+			}
+			printf("  $%02X    %12llu  %12llu  %5.1f%%\n", busy[i], (unsigned long long)reads,
+				(unsigned long long)writes, Percent(pages[busy[i]], total));
+		}
+
+		printf("\nmemory addresses\n  address      reads        writes       %%\n");
+		busy = Top(accesses.data(), 0x10000, top);
+		for (size_t i = 0; i < busy.size(); i++)
+		{
+			uint32_t a = busy[i];
+			printf("  $%04X  %12llu  %12llu  %5.1f%%\n", a, (unsigned long long)all->reads[a],
+				(unsigned long long)all->writes[a], Percent(accesses[a], total));
+		}
+	}
+
+	printf("\ninterrupt latency, cycles from the line raised to the handler\n");
+	PrintLatency("IRQ", all->irq);
+	PrintLatency("NMI", all->nmi);
+
+	for (size_t i = 0; i < shards.size(); i++) delete shards[i];
+	if (size) munmap((void*)data, size);
+	return 0;
+}
@@ -0,0 +1,832 @@
+// Microbenchmarks for the interpreter core. A few 65C02 programs are run
+// with every dispatch method, reporting emulated MHz, host nanoseconds per
+// instruction and per emulated cycle. There is no build file, compile it
+// together with the core:
+//
+//   g++ -O2 -std=c++11 wdc65c02_bench.cpp wdc65c02.cpp wdc65c02_trace.cpp
+//     -o wdc65c02_bench -lpthread
+//
+// usage: wdc65c02_bench [-n instructions] [-r runs] [-t file] [-b file] [workload ...]
+//
+// With -t the timed runs write an instruction trace to the file (the last
+// one run is what's left in it), for the cost of tracing, with -b a trace
+// of the control transfers only (TRACE_BRANCHES).
+//
+// Every program starts at $0200 and loops forever, counting finished
+// passes at $F0 and leaving its result at $F2. The result is checked
+// before a workload is timed. Each figure is the median of several runs,
+// so a busy host disturbs it less than a single long one.
+
+#include "wdc65c02.h"
+#include "wdc65c02_trace.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+// Sieve of Eratosthenes over 8192 flags at $2000. Zero page: ptr $10,
+// q $12, i $14, cnt $16. Leaves the number of primes in $F2.
+static const uint8_t sieveCode[] = {
+	0xA9, 0x00,        // 0200  start:  LDA #$00
+	0x85, 0x10,        // 0202          STA ptr
+	0xA9, 0x20,        // 0204          LDA #$20
+	0x85, 0x11,        // 0206          STA ptr+1
+	0xA2, 0x20,        // 0208          LDX #$20
+	0xA9, 0x01,        // 020A          LDA #$01
+	0xA0, 0x00,        // 020C          LDY #$00
+	0x91, 0x10,        // 020E  fill:   STA (ptr),Y
+	0xC8,              // 0210          INY
+	0xD0, 0xFB,        // 0211          BNE fill
+	0xE6, 0x11,        // 0213          INC ptr+1
+	0xCA,              // 0215          DEX
+	0xD0, 0xF6,        // 0216          BNE fill
+	0x64, 0x16,        // 0218          STZ cnt
+	0x64, 0x17,        // 021A          STZ cnt+1
+	0xA9, 0x02,        // 021C          LDA #$02
+	0x85, 0x14,        // 021E          STA i
+	0x64, 0x15,        // 0220          STZ i+1
+	0x18,              // 0222  loop:   CLC
+	0xA5, 0x14,        // 0223          LDA i
+	0x85, 0x12,        // 0225          STA q
+	0xA5, 0x15,        // 0227          LDA i+1
+	0x69, 0x20,        // 0229          ADC #$20
+	0x85, 0x13,        // 022B          STA q+1
+	0xB2, 0x12,        // 022D          LDA (q)
+	0xF0, 0x1D,        // 022F          BEQ next
+	0xE6, 0x16,        // 0231          INC cnt
+	0xD0, 0x02,        // 0233          BNE mark
+	0xE6, 0x17,        // 0235          INC cnt+1
+	0x18,              // 0237  mark:   CLC
+	0xA5, 0x12,        // 0238          LDA q
+	0x65, 0x14,        // 023A          ADC i
+	0x85, 0x12,        // 023C          STA q
+	0xA5, 0x13,        // 023E          LDA q+1
+	0x65, 0x15,        // 0240          ADC i+1
+	0x85, 0x13,        // 0242          STA q+1
+	0xC9, 0x40,        // 0244          CMP #$40
+	0xB0, 0x06,        // 0246          BCS next
+	0xA9, 0x00,        // 0248          LDA #$00
+	0x92, 0x12,        // 024A          STA (q)
+	0x80, 0xE9,        // 024C          BRA mark
+	0xE6, 0x14,        // 024E  next:   INC i
+	0xD0, 0x02,        // 0250          BNE test
+	0xE6, 0x15,        // 0252          INC i+1
+	0xA5, 0x15,        // 0254  test:   LDA i+1
+	0xC9, 0x20,        // 0256          CMP #$20
+	0xD0, 0xC8,        // 0258          BNE loop
+	0xA5, 0x16,        // 025A          LDA cnt
+	0x85, 0xF2,        // 025C          STA res
+	0xA5, 0x17,        // 025E          LDA cnt+1
+	0x85, 0xF3,        // 0260          STA res+1
+	0xE6, 0xF0,        // 0262          INC pass
+	0xD0, 0x02,        // 0264          BNE again
+	0xE6, 0xF1,        // 0266          INC pass+1
+	0x4C, 0x00, 0x02,  // 0268  again:  JMP start
+};
+
+// CRC-16/CCITT of the 256 bytes at $1000, crc at $10. Leaves the CRC in $F2.
+static const uint8_t crc16Code[] = {
+	0xA9, 0xFF,        // 0200  start:  LDA #$FF
+	0x85, 0x10,        // 0202          STA crc
+	0x85, 0x11,        // 0204          STA crc+1
+	0xA0, 0x00,        // 0206          LDY #$00
+	0xB9, 0x00, 0x10,  // 0208  byte:   LDA buf,Y
+	0x45, 0x11,        // 020B          EOR crc+1
+	0x85, 0x11,        // 020D          STA crc+1
+	0xA2, 0x08,        // 020F          LDX #$08
+	0x06, 0x10,        // 0211  bit:    ASL crc
+	0x26, 0x11,        // 0213          ROL crc+1
+	0x90, 0x0C,        // 0215          BCC noxor
+	0xA5, 0x11,        // 0217          LDA crc+1
+	0x49, 0x10,        // 0219          EOR #$10
+	0x85, 0x11,        // 021B          STA crc+1
+	0xA5, 0x10,        // 021D          LDA crc
+	0x49, 0x21,        // 021F          EOR #$21
+	0x85, 0x10,        // 0221          STA crc
+	0xCA,              // 0223  noxor:  DEX
+	0xD0, 0xEB,        // 0224          BNE bit
+	0xC8,              // 0226          INY
+	0xD0, 0xDF,        // 0227          BNE byte
+	0xA5, 0x10,        // 0229          LDA crc
+	0x85, 0xF2,        // 022B          STA res
+	0xA5, 0x11,        // 022D          LDA crc+1
+	0x85, 0xF3,        // 022F          STA res+1
+	0xE6, 0xF0,        // 0231          INC pass
+	0xD0, 0x02,        // 0233          BNE again
+	0xE6, 0xF1,        // 0235          INC pass+1
+	0x4C, 0x00, 0x02,  // 0237  again:  JMP start
+};
+
+// CRC-32 of the 256 bytes at $1000, bit by bit, crc at $10. Leaves the CRC in $F2.
+static const uint8_t crc32Code[] = {
+	0xA9, 0xFF,        // 0200  start:  LDA #$FF
+	0x85, 0x10,        // 0202          STA crc
+	0x85, 0x11,        // 0204          STA crc+1
+	0x85, 0x12,        // 0206          STA crc+2
+	0x85, 0x13,        // 0208          STA crc+3
+	0xA0, 0x00,        // 020A          LDY #$00
+	0xB9, 0x00, 0x10,  // 020C  byte:   LDA buf,Y
+	0x45, 0x10,        // 020F          EOR crc
+	0x85, 0x10,        // 0211          STA crc
+	0xA2, 0x08,        // 0213          LDX #$08
+	0x46, 0x13,        // 0215  bit:    LSR crc+3
+	0x66, 0x12,        // 0217          ROR crc+2
+	0x66, 0x11,        // 0219          ROR crc+1
+	0x66, 0x10,        // 021B          ROR crc
+	0x90, 0x18,        // 021D          BCC noxor
+	0xA5, 0x13,        // 021F          LDA crc+3
+	0x49, 0xED,        // 0221          EOR #$ED
+	0x85, 0x13,        // 0223          STA crc+3
+	0xA5, 0x12,        // 0225          LDA crc+2
+	0x49, 0xB8,        // 0227          EOR #$B8
+	0x85, 0x12,        // 0229          STA crc+2
+	0xA5, 0x11,        // 022B          LDA crc+1
+	0x49, 0x83,        // 022D          EOR #$83
+	0x85, 0x11,        // 022F          STA crc+1
+	0xA5, 0x10,        // 0231          LDA crc
+	0x49, 0x20,        // 0233          EOR #$20
+	0x85, 0x10,        // 0235          STA crc
+	0xCA,              // 0237  noxor:  DEX
+	0xD0, 0xDB,        // 0238          BNE bit
+	0xC8,              // 023A          INY
+	0xD0, 0xCF,        // 023B          BNE byte
+	0xA2, 0x03,        // 023D          LDX #$03
+	0xB5, 0x10,        // 023F  final:  LDA crc,X
+	0x49, 0xFF,        // 0241          EOR #$FF
+	0x95, 0xF2,        // 0243          STA res,X
+	0xCA,              // 0245          DEX
+	0x10, 0xF7,        // 0246          BPL final
+	0xE6, 0xF0,        // 0248          INC pass
+	0xD0, 0x02,        // 024A          BNE again
+	0xE6, 0xF1,        // 024C          INC pass+1
+	0x4C, 0x00, 0x02,  // 024E  again:  JMP start
+};
+
+// Fills $4000-$4FFF with the pass count and copies it to $5000, src at $10,
+// dst at $12. Leaves the last byte copied in $F2.
+static const uint8_t memcpyCode[] = {
+	0xA5, 0xF0,        // 0200  start:  LDA pass
+	0x64, 0x12,        // 0202          STZ dst
+	0xA2, 0x40,        // 0204          LDX #$40
+	0x86, 0x13,        // 0206          STX dst+1
+	0xA2, 0x10,        // 0208          LDX #$10
+	0xA0, 0x00,        // 020A          LDY #$00
+	0x91, 0x12,        // 020C  set:    STA (dst),Y
+	0xC8,              // 020E          INY
+	0xD0, 0xFB,        // 020F          BNE set
+	0xE6, 0x13,        // 0211          INC dst+1
+	0xCA,              // 0213          DEX
+	0xD0, 0xF6,        // 0214          BNE set
+	0x64, 0x10,        // 0216          STZ src
+	0xA9, 0x40,        // 0218          LDA #$40
+	0x85, 0x11,        // 021A          STA src+1
+	0x64, 0x12,        // 021C          STZ dst
+	0xA9, 0x50,        // 021E          LDA #$50
+	0x85, 0x13,        // 0220          STA dst+1
+	0xA2, 0x10,        // 0222          LDX #$10
+	0xB1, 0x10,        // 0224  copy:   LDA (src),Y
+	0x91, 0x12,        // 0226          STA (dst),Y
+	0xC8,              // 0228          INY
+	0xD0, 0xF9,        // 0229          BNE copy
+	0xE6, 0x11,        // 022B          INC src+1
+	0xE6, 0x13,        // 022D          INC dst+1
+	0xCA,              // 022F          DEX
+	0xD0, 0xF2,        // 0230          BNE copy
+	0xAD, 0xFF, 0x5F,  // 0232          LDA $5FFF
+	0x85, 0xF2,        // 0235          STA res
+	0xE6, 0xF0,        // 0237          INC pass
+	0xD0, 0x02,        // 0239          BNE again
+	0xE6, 0xF1,        // 023B          INC pass+1
+	0x4C, 0x00, 0x02,  // 023D  again:  JMP start
+};
+
+// 8 digit decimal mode additions and subtractions, acc at $10. Leaves the
+// result in $F2.
+static const uint8_t bcdCode[] = {
+	0xF8,              // 0200  start:  SED
+	0x64, 0x10,        // 0201          STZ acc
+	0x64, 0x11,        // 0203          STZ acc+1
+	0x64, 0x12,        // 0205          STZ acc+2
+	0x64, 0x13,        // 0207          STZ acc+3
+	0xA2, 0xC8,        // 0209          LDX #200
+	0x18,              // 020B  add:    CLC
+	0xA5, 0x10,        // 020C          LDA acc
+	0x69, 0x78,        // 020E          ADC #$78
+	0x85, 0x10,        // 0210          STA acc
+	0xA5, 0x11,        // 0212          LDA acc+1
+	0x69, 0x56,        // 0214          ADC #$56
+	0x85, 0x11,        // 0216          STA acc+1
+	0xA5, 0x12,        // 0218          LDA acc+2
+	0x69, 0x34,        // 021A          ADC #$34
+	0x85, 0x12,        // 021C          STA acc+2
+	0xA5, 0x13,        // 021E          LDA acc+3
+	0x69, 0x12,        // 0220          ADC #$12
+	0x85, 0x13,        // 0222          STA acc+3
+	0xCA,              // 0224          DEX
+	0xD0, 0xE4,        // 0225          BNE add
+	0xA2, 0x64,        // 0227          LDX #100
+	0x38,              // 0229  sub:    SEC
+	0xA5, 0x10,        // 022A          LDA acc
+	0xE9, 0x54,        // 022C          SBC #$54
+	0x85, 0x10,        // 022E          STA acc
+	0xA5, 0x11,        // 0230          LDA acc+1
+	0xE9, 0x76,        // 0232          SBC #$76
+	0x85, 0x11,        // 0234          STA acc+1
+	0xA5, 0x12,        // 0236          LDA acc+2
+	0xE9, 0x98,        // 0238          SBC #$98
+	0x85, 0x12,        // 023A          STA acc+2
+	0xA5, 0x13,        // 023C          LDA acc+3
+	0xE9, 0x00,        // 023E          SBC #$00
+	0x85, 0x13,        // 0240          STA acc+3
+	0xCA,              // 0242          DEX
+	0xD0, 0xE4,        // 0243          BNE sub
+	0xD8,              // 0245          CLD
+	0xA2, 0x03,        // 0246          LDX #$03
+	0xB5, 0x10,        // 0248  result: LDA acc,X
+	0x95, 0xF2,        // 024A          STA res,X
+	0xCA,              // 024C          DEX
+	0x10, 0xF9,        // 024D          BPL result
+	0xE6, 0xF0,        // 024F          INC pass
+	0xD0, 0x02,        // 0251          BNE again
+	0xE6, 0xF1,        // 0253          INC pass+1
+	0x4C, 0x00, 0x02,  // 0255  again:  JMP start
+};
+
+// A summing loop, interrupted by a timer every timerPeriod cycles. The
+// handler acknowledges the interrupt by writing $D000 and counts ticks in $F2.
+static const uint8_t timerCode[] = {
+	0x58,              // 0200  start:  CLI
+	0xA2, 0x00,        // 0201  loop:   LDX #$00
+	0xBD, 0x00, 0x10,  // 0203  inner:  LDA buf,X
+	0x18,              // 0206          CLC
+	0x65, 0x10,        // 0207          ADC sum
+	0x85, 0x10,        // 0209          STA sum
+	0xE8,              // 020B          INX
+	0xD0, 0xF5,        // 020C          BNE inner
+	0xE6, 0xF0,        // 020E          INC pass
+	0xD0, 0xEF,        // 0210          BNE loop
+	0xE6, 0xF1,        // 0212          INC pass+1
+	0x80, 0xEB,        // 0214          BRA loop
+	0x48,              // 0216  isr:    PHA
+	0x8D, 0x00, 0xD0,  // 0217          STA ack
+	0xE6, 0xF2,        // 021A          INC res
+	0xD0, 0x02,        // 021C          BNE done
+	0xE6, 0xF3,        // 021E          INC res+1
+	0x68,              // 0220  done:   PLA
+	0x40,              // 0221          RTI
+};
+
+// Self checking test of loads, stores, binary and decimal arithmetic,
+// shifts, logic, compares, the stack, 65C02 bit instructions, indirect jumps
+// and BRK. Ends up at fail with the failing test number in $10.
+static const uint8_t funcCode[] = {
+	0x78,              // 0200  start:  SEI
+	0xD8,              // 0201          CLD
+	0xA2, 0xFF,        // 0202          LDX #$FF
+	0x9A,              // 0204          TXS
+	0xA9, 0x01,        // 0205          LDA #$01
+	0x85, 0x10,        // 0207          STA test
+	0xA9, 0x5A,        // 0209          LDA #$5A
+	0x85, 0x20,        // 020B          STA zp
+	0xA6, 0x20,        // 020D          LDX zp
+	0xE0, 0x5A,        // 020F          CPX #$5A
+	0xD0, 0x3E,        // 0211          BNE fail1
+	0x8A,              // 0213          TXA
+	0xA8,              // 0214          TAY
+	0xC0, 0x5A,        // 0215          CPY #$5A
+	0xD0, 0x38,        // 0217          BNE fail1
+	0xA0, 0x03,        // 0219          LDY #$03
+	0x99, 0x00, 0x04,  // 021B          STA data,Y
+	0xA9, 0x00,        // 021E          LDA #$00
+	0xAD, 0x03, 0x04,  // 0220          LDA data+3
+	0xC9, 0x5A,        // 0223          CMP #$5A
+	0xD0, 0x2A,        // 0225          BNE fail1
+	0xA2, 0xE0,        // 0227          LDX #$E0
+	0xA9, 0x77,        // 0229          LDA #$77
+	0x95, 0x40,        // 022B          STA $40,X
+	0xA5, 0x20,        // 022D          LDA $20
+	0xC9, 0x77,        // 022F          CMP #$77
+	0xD0, 0x1E,        // 0231          BNE fail1
+	0xA9, 0x00,        // 0233          LDA #<data
+	0x85, 0x30,        // 0235          STA ptr
+	0xA9, 0x04,        // 0237          LDA #>data
+	0x85, 0x31,        // 0239          STA ptr+1
+	0xA9, 0x33,        // 023B          LDA #$33
+	0x92, 0x30,        // 023D          STA (ptr)
+	0xA0, 0x03,        // 023F          LDY #$03
+	0xB1, 0x30,        // 0241          LDA (ptr),Y
+	0xC9, 0x5A,        // 0243          CMP #$5A
+	0xD0, 0x0A,        // 0245          BNE fail1
+	0xA2, 0x02,        // 0247          LDX #$02
+	0xA1, 0x2E,        // 0249          LDA (ptr-2,X)
+	0xC9, 0x33,        // 024B          CMP #$33
+	0xD0, 0x02,        // 024D          BNE fail1
+	0x80, 0x03,        // 024F          BRA t2
+	0x4C, 0x94, 0x03,  // 0251  fail1:  JMP fail
+	0xA9, 0x02,        // 0254  t2:     LDA #$02
+	0x85, 0x10,        // 0256          STA test
+	0x18,              // 0258          CLC
+	0xA9, 0x50,        // 0259          LDA #$50
+	0x69, 0x50,        // 025B          ADC #$50
+	0x08,              // 025D          PHP
+	0xC9, 0xA0,        // 025E          CMP #$A0
+	0xD0, 0xEF,        // 0260          BNE fail1
+	0x68,              // 0262          PLA
+	0x29, 0xC3,        // 0263          AND #$C3
+	0xC9, 0xC0,        // 0265          CMP #$C0
+	0xD0, 0xE8,        // 0267          BNE fail1
+	0x38,              // 0269          SEC
+	0xA9, 0x00,        // 026A          LDA #$00
+	0xE9, 0x01,        // 026C          SBC #$01
+	0x08,              // 026E          PHP
+	0xC9, 0xFF,        // 026F          CMP #$FF
+	0xD0, 0xDE,        // 0271          BNE fail1
+	0x68,              // 0273          PLA
+	0x29, 0xC3,        // 0274          AND #$C3
+	0xC9, 0x80,        // 0276          CMP #$80
+	0xD0, 0xD7,        // 0278          BNE fail1
+	0x18,              // 027A          CLC
+	0xA9, 0xFF,        // 027B          LDA #$FF
+	0x69, 0x01,        // 027D          ADC #$01
+	0x08,              // 027F          PHP
+	0x68,              // 0280          PLA
+	0x29, 0xC3,        // 0281          AND #$C3
+	0xC9, 0x03,        // 0283          CMP #$03
+	0xD0, 0xCA,        // 0285          BNE fail1
+	0xA9, 0x03,        // 0287          LDA #$03
+	0x85, 0x10,        // 0289          STA test
+	0xF8,              // 028B          SED
+	0x18,              // 028C          CLC
+	0xA9, 0x58,        // 028D          LDA #$58
+	0x69, 0x46,        // 028F          ADC #$46
+	0x08,              // 0291          PHP
+	0xD8,              // 0292          CLD
+	0xC9, 0x04,        // 0293          CMP #$04
+	0xD0, 0x42,        // 0295          BNE fail2
+	0x68,              // 0297          PLA
+	0x29, 0x01,        // 0298          AND #$01
+	0xF0, 0x3D,        // 029A          BEQ fail2
+	0xF8,              // 029C          SED
+	0x38,              // 029D          SEC
+	0xA9, 0x12,        // 029E          LDA #$12
+	0xE9, 0x21,        // 02A0          SBC #$21
+	0xD8,              // 02A2          CLD
+	0xB0, 0x34,        // 02A3          BCS fail2
+	0xC9, 0x91,        // 02A5          CMP #$91
+	0xD0, 0x30,        // 02A7          BNE fail2
+	0xA9, 0x04,        // 02A9          LDA #$04
+	0x85, 0x10,        // 02AB          STA test
+	0xA9, 0x81,        // 02AD          LDA #$81
+	0x0A,              // 02AF          ASL A
+	0x90, 0x27,        // 02B0          BCC fail2
+	0xC9, 0x02,        // 02B2          CMP #$02
+	0xD0, 0x23,        // 02B4          BNE fail2
+	0x6A,              // 02B6          ROR A
+	0xB0, 0x20,        // 02B7          BCS fail2
+	0xC9, 0x81,        // 02B9          CMP #$81
+	0xD0, 0x1C,        // 02BB          BNE fail2
+	0x85, 0x20,        // 02BD          STA zp
+	0x46, 0x20,        // 02BF          LSR zp
+	0x90, 0x16,        // 02C1          BCC fail2
+	0x26, 0x20,        // 02C3          ROL zp
+	0xA5, 0x20,        // 02C5          LDA zp
+	0xC9, 0x81,        // 02C7          CMP #$81
+	0xD0, 0x0E,        // 02C9          BNE fail2
+	0xE6, 0x20,        // 02CB          INC zp
+	0xC6, 0x20,        // 02CD          DEC zp
+	0xC6, 0x20,        // 02CF          DEC zp
+	0xA5, 0x20,        // 02D1          LDA zp
+	0xC9, 0x80,        // 02D3          CMP #$80
+	0xD0, 0x02,        // 02D5          BNE fail2
+	0x80, 0x03,        // 02D7          BRA t5
+	0x4C, 0x94, 0x03,  // 02D9  fail2:  JMP fail
+	0xA9, 0x05,        // 02DC  t5:     LDA #$05
+	0x85, 0x10,        // 02DE          STA test
+	0xA9, 0xF0,        // 02E0          LDA #$F0
+	0x29, 0x3C,        // 02E2          AND #$3C
+	0x09, 0x01,        // 02E4          ORA #$01
+	0x49, 0xFF,        // 02E6          EOR #$FF
+	0xC9, 0xCE,        // 02E8          CMP #$CE
+	0xD0, 0xED,        // 02EA          BNE fail2
+	0xA9, 0xC0,        // 02EC          LDA #$C0
+	0x85, 0x20,        // 02EE          STA zp
+	0xA9, 0x01,        // 02F0          LDA #$01
+	0x24, 0x20,        // 02F2          BIT zp
+	0x10, 0xE3,        // 02F4          BPL fail2
+	0x50, 0xE1,        // 02F6          BVC fail2
+	0xD0, 0xDF,        // 02F8          BNE fail2
+	0x89, 0x01,        // 02FA          BIT #$01
+	0xF0, 0xDB,        // 02FC          BEQ fail2
+	0xA2, 0x10,        // 02FE          LDX #$10
+	0xE0, 0x20,        // 0300          CPX #$20
+	0xB0, 0xD5,        // 0302          BCS fail2
+	0xA0, 0x30,        // 0304          LDY #$30
+	0xC0, 0x30,        // 0306          CPY #$30
+	0xD0, 0xCF,        // 0308          BNE fail2
+	0x90, 0xCD,        // 030A          BCC fail2
+	0xA9, 0x06,        // 030C          LDA #$06
+	0x85, 0x10,        // 030E          STA test
+	0xA9, 0x11,        // 0310          LDA #$11
+	0xA2, 0x22,        // 0312          LDX #$22
+	0xA0, 0x33,        // 0314          LDY #$33
+	0x48,              // 0316          PHA
+	0xDA,              // 0317          PHX
+	0x5A,              // 0318          PHY
+	0xA9, 0x00,        // 0319          LDA #$00
+	0xAA,              // 031B          TAX
+	0xA8,              // 031C          TAY
+	0x68,              // 031D          PLA
+	0x7A,              // 031E          PLY
+	0xFA,              // 031F          PLX
+	0xC9, 0x33,        // 0320          CMP #$33
+	0xD0, 0x45,        // 0322          BNE fail3
+	0xC0, 0x22,        // 0324          CPY #$22
+	0xD0, 0x41,        // 0326          BNE fail3
+	0xE0, 0x11,        // 0328          CPX #$11
+	0xD0, 0x3D,        // 032A          BNE fail3
+	0xBA,              // 032C          TSX
+	0xE0, 0xFF,        // 032D          CPX #$FF
+	0xD0, 0x38,        // 032F          BNE fail3
+	0x20, 0x8E, 0x03,  // 0331          JSR sub
+	0xC9, 0x99,        // 0334          CMP #$99
+	0xD0, 0x31,        // 0336          BNE fail3
+	0xA9, 0x07,        // 0338          LDA #$07
+	0x85, 0x10,        // 033A          STA test
+	0xA9, 0x0F,        // 033C          LDA #$0F
+	0x85, 0x20,        // 033E          STA zp
+	0xA9, 0x30,        // 0340          LDA #$30
+	0x04, 0x20,        // 0342          TSB zp
+	0xD0, 0x23,        // 0344          BNE fail3
+	0xA9, 0x03,        // 0346          LDA #$03
+	0x14, 0x20,        // 0348          TRB zp
+	0xF0, 0x1D,        // 034A          BEQ fail3
+	0xA5, 0x20,        // 034C          LDA zp
+	0xC9, 0x3C,        // 034E          CMP #$3C
+	0xD0, 0x17,        // 0350          BNE fail3
+	0xF7, 0x20,        // 0352          SMB7 zp
+	0x27, 0x20,        // 0354          RMB2 zp
+	0x7F, 0x20, 0x10,  // 0356          BBR7 zp,fail3
+	0xAF, 0x20, 0x0D,  // 0359          BBS2 zp,fail3
+	0xA5, 0x20,        // 035C          LDA zp
+	0xC9, 0xB8,        // 035E          CMP #$B8
+	0xD0, 0x07,        // 0360          BNE fail3
+	0x64, 0x20,        // 0362          STZ zp
+	0x8F, 0x20, 0x02,  // 0364          BBS0 zp,fail3
+	0x80, 0x03,        // 0367          BRA t8
+	0x4C, 0x94, 0x03,  // 0369  fail3:  JMP fail
+	0xA9, 0x08,        // 036C  t8:     LDA #$08
+	0x85, 0x10,        // 036E          STA test
+	0xA2, 0x02,        // 0370          LDX #$02
+	0x7C, 0x97, 0x03,  // 0372          JMP (jumps,X)
+	0x4C, 0x94, 0x03,  // 0375  j1:     JMP fail
+	0x6C, 0x9B, 0x03,  // 0378  j2:     JMP (vector)
+	0x64, 0x32,        // 037B  j3:     STZ brks
+	0x00,              // 037D          BRK
+	0x00,              // 037E          .byte $00
+	0xA5, 0x32,        // 037F          LDA brks
+	0xC9, 0x01,        // 0381          CMP #$01
+	0xD0, 0xE4,        // 0383          BNE fail3
+	0xE6, 0xF0,        // 0385          INC pass
+	0xD0, 0x02,        // 0387          BNE again
+	0xE6, 0xF1,        // 0389          INC pass+1
+	0x4C, 0x00, 0x02,  // 038B  again:  JMP start
+	0xA9, 0x99,        // 038E  sub:    LDA #$99
+	0x60,              // 0390          RTS
+	0xE6, 0x32,        // 0391  brk:    INC brks
+	0x40,              // 0393          RTI
+	0x4C, 0x94, 0x03,  // 0394  fail:   JMP fail
+	0x75, 0x03, 0x78, 0x03, // 0397  jumps:  .word j1, j2
+	0x7B, 0x03,        // 039B  vector: .word j3
+};
+
+
+static const uint32_t timerPeriod = 250; // cycles between timer interrupts
+
+struct Machine
+{
+	uint8_t mem[0x10000];
+	wdc65c02* cpu;
+	uint64_t cycles;
+	uint64_t tick; // when the timer is due next
+};
+
+// $D000-$D0FF is left on the bus, everything else is RAM
+static uint8_t BusRead(void* context, uint16_t address)
+{
+	return 0xFF;
+}
+
+static void BusWrite(void* context, uint16_t address, uint8_t value)
+{
+	Machine* machine = (Machine*)context;
+	if (address == 0xD000) machine->cpu->SetIRQLine(1, false);
+}
+
+static void Timer(void* context, uint64_t cycle)
+{
+	Machine* machine = (Machine*)context;
+	machine->cpu->SetIRQLine(1, true);
+	machine->tick += timerPeriod;
+	machine->cpu->Schedule(machine->tick, Timer, machine);
+}
+
+static uint16_t Result16(Machine* machine)
+{
+	return machine->mem[0xF2] | (machine->mem[0xF3] << 8);
+}
+
+static uint32_t Result32(Machine* machine)
+{
+	return Result16(machine) | (machine->mem[0xF4] << 16) | ((uint32_t)machine->mem[0xF5] << 24);
+}
+
+static uint16_t Passes(Machine* machine)
+{
+	return machine->mem[0xF0] | (machine->mem[0xF1] << 8);
+}
+
+static uint16_t Crc16(const uint8_t* data, size_t size)
+{
+	uint16_t crc = 0xFFFF;
+	for (size_t i = 0; i < size; i++)
+	{
+		crc ^= data[i] << 8;
+		for (int bit = 0; bit < 8; bit++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+static uint32_t Crc32(const uint8_t* data, size_t size)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < size; i++)
+	{
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; bit++) crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+	}
+	return ~crc;
+}
+
+static bool CheckSieve(Machine* machine)
+{
+	return Result16(machine) == 1028; // primes below 8192
+}
+
+static bool CheckCrc16(Machine* machine)
+{
+	return Result16(machine) == Crc16(machine->mem + 0x1000, 256);
+}
+
+static bool CheckCrc32(Machine* machine)
+{
+	return Result32(machine) == Crc32(machine->mem + 0x1000, 256);
+}
+
+static bool CheckMemcpy(Machine* machine)
+{
+	return machine->mem[0xF2] == (uint8_t)(Passes(machine) - 1) && machine->mem[0xF2] == machine->mem[0x5FFF];
+}
+
+static bool CheckBcd(Machine* machine)
+{
+	return Result32(machine) == 0x70370200; // (200 * 12345678 - 100 * 987654) mod 10^8
+}
+
+static bool CheckTimer(Machine* machine)
+{
+	uint32_t expected = (uint32_t)(machine->cycles / timerPeriod);
+	uint32_t ticks = Result16(machine);
+	return ticks + 2 >= expected && ticks <= expected;
+}
+
+static bool CheckFunc(Machine* machine)
+{
+	return machine->cpu->GetPC() != 0x0394; // fail
+}
+
+struct Workload
+{
+	const char* name;
+	const uint8_t* code;
+	size_t size;
+	uint16_t irq; // IRQ/BRK vector
+	bool timer;
+	bool (*check)(Machine* machine);
+};
+
+static const Workload workloads[] = {
+	{ "sieve",  sieveCode,  sizeof(sieveCode),  0x0000, false, CheckSieve },
+	{ "crc16",  crc16Code,  sizeof(crc16Code),  0x0000, false, CheckCrc16 },
+	{ "crc32",  crc32Code,  sizeof(crc32Code),  0x0000, false, CheckCrc32 },
+	{ "memcpy", memcpyCode, sizeof(memcpyCode), 0x0000, false, CheckMemcpy },
+	{ "bcd",    bcdCode,    sizeof(bcdCode),    0x0000, false, CheckBcd },
+	{ "timer",  timerCode,  sizeof(timerCode),  0x0216, true,  CheckTimer },
+	{ "func",   funcCode,   sizeof(funcCode),   0x0391, false, CheckFunc },
+};
+
+static const struct
+{
+	const char* name;
+	wdc65c02::DispatchMethod method;
+} dispatches[] = {
+	{ "TABLE",   wdc65c02::TABLE_DISPATCH },
+	{ "SWITCH",  wdc65c02::SWITCH_DISPATCH },
+	{ "BLOCK",   wdc65c02::BLOCK_DISPATCH },
+	{ "TRACE",   wdc65c02::TRACE_DISPATCH },
+};
+
+static const size_t workloadCount = sizeof(workloads) / sizeof(workloads[0]);
+static const size_t dispatchCount = sizeof(dispatches) / sizeof(dispatches[0]);
+
+static Machine* Load(const Workload& workload, wdc65c02::DispatchMethod method)
+{
+	Machine* machine = new Machine();
+	memset(machine->mem, 0, sizeof(machine->mem));
+	memcpy(machine->mem + 0x0200, workload.code, workload.size);
+	for (int i = 0; i < 256; i++) machine->mem[0x1000 + i] = (uint8_t)(i * 37 + 11);
+	machine->mem[0xFFFC] = 0x00;
+	machine->mem[0xFFFD] = 0x02;
+	machine->mem[0xFFFE] = workload.irq & 0xFF;
+	machine->mem[0xFFFF] = workload.irq >> 8;
+	machine->cycles = 0;
+	machine->tick = timerPeriod;
+
+	machine->cpu = new wdc65c02(BusRead, BusWrite, machine);
+	machine->cpu->MapRAM(0x0000, 0xD000, machine->mem);
+	machine->cpu->MapRAM(0xD100, 0x2F00, machine->mem + 0xD100);
+	machine->cpu->SetDispatch(method);
+	machine->cpu->Reset();
+	if (workload.timer) machine->cpu->Schedule(machine->tick, Timer, machine);
+	return machine;
+}
+
+static void Unload(Machine* machine)
+{
+	delete machine->cpu;
+	delete machine;
+}
+
+// WAI with interrupts disabled and an IRQ line that's already held (raised
+// after SEI) has to fall straight through to the next instruction.
+static bool CheckWaiHeld(Machine* machine)
+{
+	static const uint8_t code[] = {
+		0x78,              // 0200  start:  SEI
+		0xA9, 0x00,        // 0201          LDA #$00
+		0xCB,              // 0203          WAI
+		0xE8,              // 0204          INX
+		0x80, 0xFE,        // 0205  halt:   BRA halt
+	};
+	memcpy(machine->mem + 0x0200, code, sizeof(code));
+	machine->cpu->Reset();
+	machine->cpu->Run(2, machine->cycles, wdc65c02::INST_COUNT);
+	machine->cpu->SetIRQLine(1, true);
+	machine->cpu->Run(100, machine->cycles, wdc65c02::INST_COUNT);
+	return machine->cpu->GetPC() == 0x0205 && machine->cpu->GetX() == 1;
+}
+
+// Runs instructions at a time, in slices Run() can count in an int32_t.
+static void Run(Machine* machine, uint64_t instructions)
+{
+	while (instructions > 0)
+	{
+		int32_t slice = instructions > 1000000 ? 1000000 : (int32_t)instructions;
+		machine->cpu->Run(slice, machine->cycles, wdc65c02::INST_COUNT);
+		instructions -= slice;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	uint64_t instructions = 10000000;
+	int runs = 5;
+	const char* tracePath = NULL;
+	wdc65c02::TraceMode traceMode = wdc65c02::TRACE_INSTRUCTIONS;
+	std::vector<const Workload*> selected;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-n") && i + 1 < argc) instructions = strtoull(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-r") && i + 1 < argc) runs = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-t") && i + 1 < argc) tracePath = argv[++i];
+		else if (!strcmp(argv[i], "-b") && i + 1 < argc)
+		{
+			tracePath = argv[++i];
+			traceMode = wdc65c02::TRACE_BRANCHES;
+		}
+		else
+		{
+			size_t w = 0;
+			while (w < workloadCount && strcmp(argv[i], workloads[w].name)) w++;
+			if (w == workloadCount)
+			{
+				fprintf(stderr, "usage: wdc65c02_bench [-n instructions] [-r runs] [-t file] [-b file] [workload ...]\n");
+				return 2;
+			}
+			selected.push_back(&workloads[w]);
+		}
+	}
+	if (selected.empty())
+	{
+		for (size_t w = 0; w < workloadCount; w++) selected.push_back(&workloads[w]);
+	}
+	if (runs < 1) runs = 1;
+
+	printf("%-8s %-8s %9s %9s %9s\n", "workload", "dispatch", "MHz", "ns/instr", "ns/cycle");
+
+	double logSum[dispatchCount] = {0};
+	size_t timed[dispatchCount] = {0};
+	bool failed = false;
+
+	for (size_t d = 0; d < dispatchCount; d++)
+	{
+		Machine* machine = Load(workloads[0], dispatches[d].method);
+		if (machine->cpu->GetDispatch() == dispatches[d].method && !CheckWaiHeld(machine))
+		{
+			printf("%-8s %-8s FAILED\n", "wai", dispatches[d].name);
+			failed = true;
+		}
+		Unload(machine);
+	}
+
+	for (size_t w = 0; w < selected.size(); w++)
+	{
+		for (size_t d = 0; d < dispatchCount; d++)
+		{
+			Machine* machine = Load(*selected[w], dispatches[d].method);
+			if (machine->cpu->GetDispatch() != dispatches[d].method)
+			{
+				// not compiled in, see WDC65C02_BLOCKS
+				Unload(machine);
+				continue;
+			}
+
+			// warm up caches, block and trace caches included, and check
+			// that at least one pass got the right result
+			Run(machine, 2000000);
+			if (!Passes(machine) || !selected[w]->check(machine))
+			{
+				printf("%-8s %-8s FAILED\n", selected[w]->name, dispatches[d].name);
+				failed = true;
+				Unload(machine);
+				continue;
+			}
+
+			wdc65c02_trace trace;
+			if (tracePath)
+			{
+				if (!trace.Open(tracePath))
+				{
+					fprintf(stderr, "can't write %s\n", tracePath);
+					return 2;
+				}
+				machine->cpu->SetTraceRing(trace.GetRing(), traceMode);
+			}
+
+			std::vector<double> seconds;
+			std::vector<uint64_t> cycles;
+			for (int r = 0; r < runs; r++)
+			{
+				uint64_t start = machine->cycles;
+				std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+				Run(machine, instructions);
+				std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+				seconds.push_back(std::chrono::duration<double>(t1 - t0).count());
+				cycles.push_back(machine->cycles - start);
+			}
+
+			if (tracePath)
+			{
+				machine->cpu->SetTraceRing(NULL);
+				trace.Close();
+				if (trace.GetLost()) printf("%-8s %-8s %llu records lost\n", selected[w]->name, dispatches[d].name,
+					(unsigned long long)trace.GetLost());
+			}
+
+			// median run; every run executes the same number of instructions
+			std::vector<size_t> order(runs);
+			for (int r = 0; r < runs; r++) order[r] = r;
+			std::sort(order.begin(), order.end(),
+				[&](size_t x, size_t y) { return seconds[x] < seconds[y]; });
+			size_t median = order[runs / 2];
+			double mhz = cycles[median] / seconds[median] / 1e6;
+
+			printf("%-8s %-8s %9.1f %9.2f %9.3f\n", selected[w]->name, dispatches[d].name,
+				mhz, seconds[median] * 1e9 / instructions, seconds[median] * 1e9 / cycles[median]);
+			logSum[d] += log(mhz);
+			timed[d]++;
+			Unload(machine);
+		}
+	}
+
+	// geometric mean over the workloads, one figure to compare builds by
+	for (size_t d = 0; d < dispatchCount; d++)
+	{
+		if (timed[d]) printf("%-8s %-8s %9.1f\n", "all", dispatches[d].name, exp(logSum[d] / timed[d]));
+	}
+
+	return failed ? 1 : 0;
+}
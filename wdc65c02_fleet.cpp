@@ -0,0 +1,253 @@
+#include "wdc65c02_fleet.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// per-thread queue of instance indices waiting for their next slice
+struct wdc65c02_fleet::Worker
+{
+	std::mutex lock;
+	std::deque<size_t> queue;
+};
+
+struct wdc65c02_fleet::Pool
+{
+	std::vector<Worker*> workers;
+	std::atomic<size_t> remaining; // instances not finished yet
+	std::atomic<size_t> queued;    // entries in all the queues
+
+	// threads with nothing to run sleep here until there is
+	std::mutex idleLock;
+	std::condition_variable wake;
+	unsigned idle;
+
+	void Wake(bool all)
+	{
+		std::lock_guard<std::mutex> guard(idleLock);
+		if (!idle) return;
+		if (all) wake.notify_all();
+		else wake.notify_one();
+	}
+};
+
+wdc65c02_fleet::wdc65c02_fleet(unsigned threads)
+	: threads(threads)
+	, seconds(0)
+	, lastCycles(0)
+{
+	if (this->threads == 0) this->threads = std::thread::hardware_concurrency();
+	if (this->threads == 0) this->threads = 1;
+}
+
+wdc65c02_fleet::~wdc65c02_fleet()
+{
+	for (size_t i = 0; i < instances.size(); i++)
+	{
+		delete instances[i].cpu;
+	}
+}
+
+size_t wdc65c02_fleet::Add(wdc65c02* cpu)
+{
+	Instance instance;
+	instance.cpu = cpu;
+	instance.cycles = 0;
+	instance.target = 0;
+	instance.reason = STOP_NONE;
+	instances.push_back(instance);
+	return instances.size() - 1;
+}
+
+wdc65c02* wdc65c02_fleet::Get(size_t index)
+{
+	return instances[index].cpu;
+}
+
+size_t wdc65c02_fleet::Size()
+{
+	return instances.size();
+}
+
+// Runs every instance for the given number of cycles, or until it
+// executes STP, or WAI with nothing left to wake it. Instances are
+// advanced at most 'slice' cycles at a time so that long and short
+// programs balance out across the threads.
+void wdc65c02_fleet::Run(uint64_t cycles, int32_t slice)
+{
+	Pool pool;
+	uint64_t before = GetTotalCycles();
+	unsigned n = threads;
+
+	if (slice <= 0) slice = 1;
+	if (n > instances.size()) n = (unsigned)instances.size();
+	if (n == 0) n = 1;
+
+	for (unsigned i = 0; i < n; i++)
+	{
+		pool.workers.push_back(new Worker);
+	}
+	pool.remaining = 0;
+	pool.queued = 0;
+	pool.idle = 0;
+
+	// deal the instances out round-robin, skipping stopped ones
+	for (size_t i = 0; i < instances.size(); i++)
+	{
+		Instance& instance = instances[i];
+		instance.target = instance.cycles + cycles;
+		if (!Stopped(instance))
+		{
+			pool.workers[i % n]->queue.push_back(i);
+			pool.remaining++;
+			pool.queued++;
+		}
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> running;
+	for (unsigned i = 1; i < n; i++)
+	{
+		running.push_back(std::thread(&wdc65c02_fleet::Work, this, std::ref(pool), i, slice));
+	}
+	Work(pool, 0, slice);
+	for (size_t i = 0; i < running.size(); i++)
+	{
+		running[i].join();
+	}
+
+	seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	lastCycles = GetTotalCycles() - before;
+
+	for (unsigned i = 0; i < n; i++)
+	{
+		delete pool.workers[i];
+	}
+}
+
+void wdc65c02_fleet::Work(Pool& pool, unsigned self, int32_t slice)
+{
+	size_t count = pool.workers.size();
+
+	for (;;)
+	{
+		size_t index = 0;
+		bool found = false;
+
+		// own queue first, most recently run instance (still in cache)
+		{
+			Worker* worker = pool.workers[self];
+			std::lock_guard<std::mutex> guard(worker->lock);
+			if (!worker->queue.empty())
+			{
+				index = worker->queue.back();
+				worker->queue.pop_back();
+				pool.queued--;
+				found = true;
+			}
+		}
+
+		// then steal the oldest entry of another thread
+		for (size_t k = 1; !found && k < count; k++)
+		{
+			Worker* victim = pool.workers[(self + k) % count];
+			std::lock_guard<std::mutex> guard(victim->lock);
+			if (!victim->queue.empty())
+			{
+				index = victim->queue.front();
+				victim->queue.pop_front();
+				pool.queued--;
+				found = true;
+			}
+		}
+
+		if (!found)
+		{
+			// the remaining instances are being run by other threads,
+			// sleep until one of them is queued again or all are done
+			std::unique_lock<std::mutex> guard(pool.idleLock);
+			pool.idle++;
+			while (pool.queued == 0 && pool.remaining != 0) pool.wake.wait(guard);
+			pool.idle--;
+			if (pool.remaining == 0) return;
+			continue;
+		}
+
+		if (RunSlice(instances[index], slice))
+		{
+			{
+				Worker* worker = pool.workers[self];
+				std::lock_guard<std::mutex> guard(worker->lock);
+				worker->queue.push_back(index);
+				pool.queued++;
+			}
+			pool.Wake(false);
+		}
+		else if (--pool.remaining == 0)
+		{
+			pool.Wake(true);
+		}
+	}
+}
+
+// returns true if the instance needs more slices
+bool wdc65c02_fleet::RunSlice(Instance& instance, int32_t slice)
+{
+	uint64_t left = instance.target - instance.cycles;
+	int32_t budget = left < (uint64_t)slice ? (int32_t)left : slice;
+
+	instance.cpu->Run(budget, instance.cycles);
+
+	return !Stopped(instance);
+}
+
+// Updates the stop reason, returns true if the instance is done. WAI is
+// only final when nothing can end it within Run(): no interrupt flagged
+// to take, and no event that idle skipping would fast-forward to.
+bool wdc65c02_fleet::Stopped(Instance& instance)
+{
+	wdc65c02* cpu = instance.cpu;
+	uint8_t stop = cpu->GetSTOP();
+	bool wakes = cpu->GetPendingInterrupt() || (cpu->GetIdleSkip() && cpu->GetNextEvent() != UINT64_MAX);
+
+	if (stop & 0b01) instance.reason = STOP_STP;
+	else if ((stop & 0b10) && !wakes) instance.reason = STOP_WAI;
+	else if (instance.cycles >= instance.target) instance.reason = STOP_BUDGET;
+	else return false;
+	return true;
+}
+
+uint64_t wdc65c02_fleet::GetCycles(size_t index)
+{
+	return instances[index].cycles;
+}
+
+wdc65c02_fleet::StopReason wdc65c02_fleet::GetStopReason(size_t index)
+{
+	return (StopReason)instances[index].reason;
+}
+
+uint64_t wdc65c02_fleet::GetTotalCycles()
+{
+	uint64_t total = 0;
+	for (size_t i = 0; i < instances.size(); i++)
+	{
+		total += instances[i].cycles;
+	}
+	return total;
+}
+
+// aggregate emulated clock of the last Run(), summed over all instances
+double wdc65c02_fleet::GetEmulatedMHz()
+{
+	if (seconds <= 0) return 0;
+	return lastCycles / seconds / 1e6;
+}
+
+unsigned wdc65c02_fleet::GetThreads()
+{
+	return threads;
+}
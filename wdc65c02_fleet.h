@@ -0,0 +1,59 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "wdc65c02.h"
+
+// Runs many independent wdc65c02 instances on a pool of threads.
+// Every instance is advanced in slices of Run(); slices are spread over
+// per-thread queues and idle threads steal slices from busy ones.
+class wdc65c02_fleet
+{
+public:
+	enum StopReason {
+		STOP_NONE,   // not run yet
+		STOP_BUDGET, // ran for all the requested cycles
+		STOP_STP,    // STP executed
+		STOP_WAI,    // WAI executed, no interrupt or event pending
+	};
+
+	wdc65c02_fleet(unsigned threads = 0);
+	~wdc65c02_fleet();
+
+	// takes ownership of cpu, returns its index
+	size_t Add(wdc65c02* cpu);
+	wdc65c02* Get(size_t index);
+	size_t Size();
+
+	void Run(uint64_t cycles, int32_t slice = 100000);
+
+	uint64_t GetCycles(size_t index);
+	StopReason GetStopReason(size_t index);
+	uint64_t GetTotalCycles();
+	double GetEmulatedMHz();
+	unsigned GetThreads();
+
+private:
+	struct Instance
+	{
+		wdc65c02* cpu;
+		uint64_t cycles;  // total cycles run
+		uint64_t target;  // cycle count to reach in this Run()
+		uint8_t reason;
+	};
+
+	struct Worker;
+	struct Pool;
+
+	std::vector<Instance> instances;
+	unsigned threads;
+	double seconds; // wall time of the last Run()
+	uint64_t lastCycles; // cycles run by the last Run()
+
+	bool RunSlice(Instance& instance, int32_t slice);
+	bool Stopped(Instance& instance);
+	void Work(Pool& pool, unsigned self, int32_t slice);
+
+	wdc65c02_fleet(const wdc65c02_fleet&);
+	wdc65c02_fleet& operator=(const wdc65c02_fleet&);
+};
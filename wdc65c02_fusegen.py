@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+# Generates superinstructions for a firmware specific build of wdc65c02.
+#
+# Input is an opcode profile saved from GetProfile(), one sequence per line:
+#
+#   <count> <opcode> <opcode> [<opcode>]
+#
+# with the opcodes in hex, e.g. "123456 A9 85". The most frequent sequences
+# that can be fused become handlers in the output header; compile
+# wdc65c02.cpp with -DWDC65C02_BLOCKS -DWDC65C02_FUSED='"firmware_fused.h"'
+# to use them with TRACE_DISPATCH.
+#
+# usage: wdc65c02_fusegen.py profile.txt [count] > firmware_fused.h
+
+import os
+import re
+import sys
+
+# instructions that change pc or stop the processor, only allowed last
+CONTROL = {
+	'BBR', 'BBS', 'BCC', 'BCS', 'BEQ', 'BMI', 'BNE', 'BPL', 'BRA', 'BVC',
+	'BVS', 'BRK', 'JMP', 'JSR', 'RTI', 'RTS', 'STP', 'WAI',
+}
+
+# instructions that can unmask a pending IRQ, only allowed last
+UNMASK = {'CLI', 'PLP'}
+
+# instructions that write memory (possibly code), only allowed last
+WRITES = {
+	'STA', 'STX', 'STY', 'STZ', 'INC', 'DEC', 'ASL', 'LSR', 'ROL', 'ROR',
+	'TSB', 'TRB', 'RMB', 'SMB', 'PHA', 'PHX', 'PHY', 'PHP',
+}
+
+# sequences FuseTrace() already handles
+BUILTIN = [
+	({0xA9, 0xA5, 0xAD}, {0x85, 0x8D}),
+	({0xBD}, {0x9D}),
+	({0xB9}, {0x99}),
+	({0xCA, 0x88}, {0xD0}),
+	({0xE8, 0xC8}, {0xE0, 0xE4, 0xEC, 0xC0, 0xC4, 0xCC}),
+	({0xC9, 0xC5, 0xCD}, {0xF0, 0xD0, 0x90, 0xB0}),
+]
+
+
+def resolved_cases(path):
+	# the body of every ExecResolved() case, by opcode
+	source = open(path).read()
+	start = source.index('void wdc65c02::ExecResolved(')
+	end = source.index('\n}\n', start)
+	cases = {}
+	for m in re.finditer(r'case 0x([0-9A-F]{2}): (.*?) break;', source[start:end]):
+		cases[int(m.group(1), 16)] = m.group(2)
+	return cases
+
+
+def operation(body):
+	return re.search(r'Op_([A-Z]+)', body).group(1)
+
+
+def fusable(sequence, cases):
+	for i, opcode in enumerate(sequence):
+		op = operation(cases[opcode])
+		if i < len(sequence) - 1 and (op in CONTROL or op in WRITES or op in UNMASK):
+			return False
+	for first, second in BUILTIN:
+		if sequence[0] in first and sequence[1] in second:
+			return False
+	return True
+
+
+def main():
+	if len(sys.argv) < 2:
+		sys.exit('usage: wdc65c02_fusegen.py profile.txt [count] > firmware_fused.h')
+	limit = int(sys.argv[2]) if len(sys.argv) > 2 else 16
+	cases = resolved_cases(os.path.join(os.path.dirname(os.path.abspath(__file__)), 'wdc65c02.cpp'))
+
+	profile = []
+	for line in open(sys.argv[1]):
+		fields = line.split()
+		if len(fields) < 3 or fields[0].startswith('#'):
+			continue
+		profile.append((int(fields[0]), [int(f, 16) for f in fields[1:4]]))
+	profile.sort(key=lambda entry: -entry[0])
+
+	# triples first at equal counts, FuseTrace() tries them in this order
+	chosen = []
+	for count, sequence in profile:
+		if len(chosen) == limit:
+			break
+		if fusable(sequence, cases) and sequence not in chosen:
+			chosen.append(sequence)
+	chosen.sort(key=lambda sequence: -len(sequence))
+
+	out = []
+	out.append('// generated by wdc65c02_fusegen.py from %s, do not edit' % os.path.basename(sys.argv[1]))
+	out.append('#pragma once')
+	out.append('')
+
+	out.append('#define FUSED_PROFILE_IDS \\')
+	for n in range(len(chosen)):
+		out.append('\tFUSE_PROFILED_%d, \\' % n)
+	out.append('')
+
+	out.append('#define FUSED_PROFILE_MATCH \\')
+	for n, sequence in enumerate(chosen):
+		test = ' && '.join('%s == 0x%02X' % (v, o) for v, o in zip('abc', sequence))
+		out.append('\tif (!fused && %s) \\' % test)
+		out.append('\t{ \\')
+		out.append('\t\tfused = FUSE_PROFILED_%d; \\' % n)
+		out.append('\t\tlength = %d; \\' % len(sequence))
+		out.append('\t} \\')
+	out.append('')
+
+	out.append('#define FUSED_PROFILE_CASES \\')
+	for n, sequence in enumerate(chosen):
+		names = ', '.join(operation(cases[o]) for o in sequence)
+		out.append('\tcase FUSE_PROFILED_%d: /* %s */ \\' % (n, names))
+		for k, opcode in enumerate(sequence):
+			if k == len(sequence) - 1:
+				out.append('\t\tpc = trace->instr[i + %d].address + trace->instr[i + %d].length; \\' % (k, k))
+			if 'operand' in cases[opcode]:
+				out.append('\t\t{ uint16_t operand = trace->instr[i + %d].operand; %s } \\' % (k, cases[opcode]))
+			else:
+				out.append('\t\t%s \\' % cases[opcode])
+		out.append('\t\treturn %d; \\' % len(sequence))
+	out.append('')
+
+	print('\n'.join(out))
+
+
+if __name__ == '__main__':
+	main()
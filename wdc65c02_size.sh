@@ -0,0 +1,24 @@
+#!/bin/sh
+# Prints the size of wdc65c02.o for each build option, the footprint table
+# in the README.
+#
+# usage: wdc65c02_size.sh [compiler] [flags]
+#   e.g. wdc65c02_size.sh g++ -Os
+
+CXX=${1:-g++}
+[ $# -gt 0 ] && shift
+FLAGS=${*:--Os}
+DIR=$(dirname "$0")
+OBJ=$(mktemp)
+trap 'rm -f "$OBJ"' EXIT
+
+printf '%-24s %6s %6s\n' '' text data
+for OPTIONS in \
+	'default:' \
+	'BLOCKS:-DWDC65C02_BLOCKS' \
+	'NO_PROFILE:-DWDC65C02_NO_PROFILE'
+do
+	NAME=${OPTIONS%%:*}
+	"$CXX" -std=c++11 $FLAGS ${OPTIONS#*:} -c "$DIR/wdc65c02.cpp" -o "$OBJ" || exit 1
+	size "$OBJ" | awk -v name="$NAME" 'NR == 2 { printf "%-24s %6s %6s\n", name, $1, $2 }'
+done
@@ -0,0 +1,361 @@
+#include "wdc65c02_trace.h"
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+struct wdc65c02_trace::Writer
+{
+	FILE* file;
+	std::thread thread;
+	std::atomic<bool> stopping;
+};
+
+wdc65c02_trace::wdc65c02_trace(uint32_t blockSize, uint32_t blocks)
+	: writer(NULL)
+	, written(0)
+{
+	// a block holds at least one record of each kind
+	if (blockSize < 256) blockSize = 256;
+	if (blocks < 2) blocks = 2;
+
+	ring.blocks = new uint8_t[(size_t)blockSize * blocks];
+	ring.count = blocks;
+	ring.blockSize = blockSize;
+	ring.head = 0;
+	ring.tail = 0;
+	ring.lost = 0;
+}
+
+wdc65c02_trace::~wdc65c02_trace()
+{
+	Close();
+	delete[] ring.blocks;
+}
+
+bool wdc65c02_trace::Open(const char* path)
+{
+	Close();
+
+	FILE* file = fopen(path, "wb");
+	if (!file) return false;
+
+	ring.head = 0;
+	ring.tail = 0;
+	ring.lost = 0;
+	writer = new Writer;
+	writer->file = file;
+	writer->stopping = false;
+	written = 0;
+	writer->thread = std::thread(&wdc65c02_trace::Write, this);
+	return true;
+}
+
+// The processor has to be done with the ring, SetTraceRing(NULL) hands
+// over the block it was filling.
+void wdc65c02_trace::Close()
+{
+	if (!writer) return;
+
+	writer->stopping = true;
+	writer->thread.join();
+	fclose(writer->file);
+	delete writer;
+	writer = NULL;
+}
+
+wdc65c02::TraceRing* wdc65c02_trace::GetRing()
+{
+	return &ring;
+}
+
+uint64_t wdc65c02_trace::GetBytesWritten()
+{
+	return written;
+}
+
+uint64_t wdc65c02_trace::GetLost()
+{
+	return ring.lost;
+}
+
+// The writer thread. Polls the ring, there is no lock for Run() to take
+// to wake it up.
+void wdc65c02_trace::Write()
+{
+	for (;;)
+	{
+		// read before head, so a block handed over before Close() is seen
+		bool stopping = writer->stopping;
+		uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+
+		if (tail == ring.head.load(std::memory_order_acquire))
+		{
+			if (stopping) break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			continue;
+		}
+
+		const uint8_t* block = ring.blocks + (size_t)(tail % ring.count) * ring.blockSize;
+		wdc65c02::TraceBlock header;
+		memcpy(&header, block, sizeof(header));
+		fwrite(block, 1, header.bytes, writer->file);
+		written += header.bytes;
+
+		ring.tail.store(tail + 1, std::memory_order_release);
+	}
+	fflush(writer->file);
+}
+
+// READER
+
+wdc65c02_trace::Reader::Reader(const uint8_t* data, size_t size)
+	: data(data)
+	, size(size)
+	, offset(0)
+	, pos(0)
+	, end(0)
+	, left(0)
+	, next(0)
+	, kind(0)
+	, failed(false)
+{
+	memset(&last, 0, sizeof(last));
+}
+
+bool wdc65c02_trace::Reader::Next(Record& record)
+{
+	while (!left)
+	{
+		wdc65c02::TraceBlock header;
+		if (failed || size - offset < sizeof(header)) return false;
+		memcpy(&header, data + offset, sizeof(header));
+		if (header.magic != wdc65c02::TRACE_MAGIC ||
+			header.bytes < sizeof(header) || header.bytes > size - offset)
+		{
+			failed = true;
+			return false;
+		}
+
+		pos = offset + sizeof(header);
+		end = offset + header.bytes;
+		offset = end;
+		left = header.records;
+		kind = header.kind;
+		last.cycle = header.cycle;
+
+		if (header.lost)
+		{
+			last.type = RECORD_LOST;
+			last.lost = header.lost;
+			record = last;
+			return true;
+		}
+	}
+
+	// flags and cycle at least
+	if (end - pos < 2)
+	{
+		failed = true;
+		return false;
+	}
+
+	// through locals, the stores to last could be to anything else
+	const uint8_t* in = data + pos;
+	const uint8_t* stop = data + end;
+	uint8_t flags = *in++;
+	uint64_t delta = 0;
+	for (int shift = 0; in < stop; shift += 7)
+	{
+		uint8_t byte = *in++;
+		delta |= (uint64_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) break;
+	}
+	pos = in - data;
+	last.cycle += delta;
+	left--;
+
+	if (kind == wdc65c02::TRACE_BRANCHES && flags != 0xC2) return NextBranch(flags, record);
+	if ((flags & 0xC0) == 0xC0)
+	{
+		last.direct = true;
+		if (flags == 0xC0) last.type = RECORD_IRQ;
+		else if (flags == 0xC1) last.type = RECORD_NMI;
+		else if (flags == 0xC2 && end - pos >= 5)
+		{
+			last.type = RECORD_LINES;
+			last.irqLines = data[pos] | (data[pos + 1] << 8) | (data[pos + 2] << 16) | ((uint32_t)data[pos + 3] << 24);
+			last.nmiLine = data[pos + 4];
+			pos += 5;
+		}
+		else
+		{
+			failed = true;
+			return false;
+		}
+		record = last;
+		return true;
+	}
+
+	uint8_t length = (flags >> 6) + 1;
+	size_t need = ((flags & 0x20) ? 2 : 0) + length;
+	for (int i = 0; i < 5; i++) need += (flags >> i) & 1;
+	if ((size_t)(stop - in) < need)
+	{
+		failed = true;
+		return false;
+	}
+
+	uint16_t pc = next;
+	if (flags & 0x20)
+	{
+		pc = in[0] | (in[1] << 8);
+		in += 2;
+	}
+	last.type = RECORD_INSTR;
+	last.pc = pc;
+	last.opcode = *in++;
+	last.length = length;
+	for (int i = 1; i < length; i++) last.operand[i - 1] = *in++;
+
+	uint8_t* regs[5] = {&last.a, &last.x, &last.y, &last.p, &last.s};
+	for (int i = 0; i < 5; i++)
+	{
+		if (flags & (1 << i)) *regs[i] = *in++;
+	}
+
+	pos = in - data;
+	next = pc + length;
+	record = last;
+	return true;
+}
+
+bool wdc65c02_trace::Reader::Failed()
+{
+	return failed;
+}
+
+// The rest of a record of a TRACE_BRANCHES block, after the cycle.
+bool wdc65c02_trace::Reader::NextBranch(uint8_t flags, Record& record)
+{
+	bool interrupt = flags == 0xC0 || flags == 0xC1;
+	uint8_t type = flags & 0x0F;
+	bool from = interrupt || type != RECORD_SYNC - RECORD_BRANCH;
+	bool to = interrupt || (flags & 0x10);
+	size_t need = (from ? 2 : 0) + (to ? 2 : 0);
+	if ((!interrupt && ((flags & 0xE0) || type > RECORD_SYNC - RECORD_BRANCH)) || end - pos < need)
+	{
+		failed = true;
+		return false;
+	}
+
+	if (interrupt) last.type = flags == 0xC0 ? RECORD_IRQ : RECORD_NMI;
+	else last.type = RECORD_BRANCH + type;
+	last.pc = 0;
+	last.target = 0;
+	if (from)
+	{
+		last.pc = data[pos] | (data[pos + 1] << 8);
+		pos += 2;
+	}
+	if (to)
+	{
+		last.target = data[pos] | (data[pos + 1] << 8);
+		pos += 2;
+	}
+	last.direct = !to;
+	record = last;
+	return true;
+}
+
+// WALKER
+
+wdc65c02_trace::Walker::Walker(const uint8_t* memory)
+	: memory(memory)
+	, pc(0)
+	, synced(false)
+{
+}
+
+bool wdc65c02_trace::Walker::Walk(const Record& record, std::vector<uint16_t>& path)
+{
+	bool ok = true;
+	switch (record.type)
+	{
+	case RECORD_LOST:
+		synced = false;
+		return false;
+	case RECORD_SYNC:
+		if (synced) ok = Follow(record.target, path);
+		pc = record.target;
+		break;
+	case RECORD_IRQ:
+	case RECORD_NMI:
+		// taken before the instruction at the return address
+		if (synced) ok = Follow(record.pc, path);
+		pc = record.target;
+		break;
+	case RECORD_BRANCH:
+	case RECORD_JUMP:
+	case RECORD_CALL:
+	case RECORD_RETURN:
+	case RECORD_RTI:
+	case RECORD_BRK:
+		if (synced) ok = Follow(record.pc, path);
+		else ok = false;
+		path.push_back(record.pc);
+		pc = record.direct ? Target(record.pc) : record.target;
+		break;
+	default:
+		return true;
+	}
+	synced = true;
+	return ok;
+}
+
+uint16_t wdc65c02_trace::Walker::GetPC()
+{
+	return pc;
+}
+
+// Steps through the code from pc to until, which has to come before any
+// instruction that always transfers control, those are all recorded.
+bool wdc65c02_trace::Walker::Follow(uint16_t until, std::vector<uint16_t>& path)
+{
+	for (uint32_t steps = 0; pc != until; steps++)
+	{
+		uint8_t opcode = memory[pc];
+		switch (opcode)
+		{
+		case 0x00: // BRK
+		case 0x20: // JSR
+		case 0x40: // RTI
+		case 0x4C: // JMP
+		case 0x60: // RTS
+		case 0x6C:
+		case 0x7C:
+		case 0x80: // BRA
+		case 0xDB: // STP
+			return false;
+		}
+		if (steps > 0x10000) return false;
+
+		path.push_back(pc);
+		pc += wdc65c02::InstrLength(opcode);
+	}
+	return true;
+}
+
+// Where a transfer the trace has no target for goes.
+uint16_t wdc65c02_trace::Walker::Target(uint16_t address)
+{
+	uint8_t opcode = memory[address];
+	uint8_t operand = memory[(uint16_t)(address + 1)];
+
+	// BBR, BBS: zero page address, then the offset
+	if ((opcode & 0x0F) == 0x0F) return address + 3 + (int8_t)memory[(uint16_t)(address + 2)];
+	// Bxx, BRA
+	if ((opcode & 0x1F) == 0x10 || opcode == 0x80) return address + 2 + (int8_t)operand;
+	// JMP abs, JSR
+	return operand | (memory[(uint16_t)(address + 2)] << 8);
+}
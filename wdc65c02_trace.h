@@ -0,0 +1,147 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+#include "wdc65c02.h"
+
+// Streams the instruction trace of a wdc65c02 to a file. Run() fills the
+// blocks of a ring (see wdc65c02::SetTraceRing()), a thread of this class
+// writes them out as they fill up, so the emulating thread never waits on
+// the disk. The file is the blocks one after the other, each starting with
+// a wdc65c02::TraceBlock header, in the byte order of the host.
+//
+// Records, one after the other after the header:
+//   flags           bits 0-4: A, X, Y, P, S follow, 5: pc follows,
+//                   6-7: operand bytes (0-2), or 0xC0 | type below
+//   cycle           since the previous record (or the header), 7 bits a
+//                   byte, low bits first, bit 7 set on all but the last
+//   instruction     [pc, 2 bytes] opcode [operands] [A] [X] [Y] [P] [S]
+//   0xC0 IRQ, 0xC1 NMI   interrupt taken, nothing follows
+//   0xC2 lines      IRQ lines, 4 bytes, NMI line, 1 byte
+// An instruction without pc follows on from the previous one, registers
+// left out are as they were. The registers are the ones the instruction
+// starts with.
+//
+// The blocks of a TRACE_BRANCHES trace (header kind 1) hold transfers:
+//   kind            bits 0-3: type below, 4: target follows,
+//                   or 0xC0 | type as above
+//   cycle           as above, of the instruction's start
+//   from, to        2 bytes each, from missing for a sync, to for targets
+//                   in the code: branches, JMP abs, JSR
+//   0 taken branch  Bxx, BBR, BBS
+//   1 jump          BRA, JMP
+//   2 call          JSR
+//   3 return        RTS
+//   4 RTI, 5 BRK
+//   6 sync          execution is at to, first in a block
+//   0xC0 IRQ, 0xC1 NMI   from is the return address, to the handler
+class wdc65c02_trace
+{
+public:
+	wdc65c02_trace(uint32_t blockSize = 1 << 16, uint32_t blocks = 256);
+	~wdc65c02_trace();
+
+	// starts the writer thread
+	bool Open(const char* path);
+	// writes out what's left and stops it, after SetTraceRing(NULL)
+	void Close();
+
+	wdc65c02::TraceRing* GetRing();
+	uint64_t GetBytesWritten();
+	uint64_t GetLost(); // records dropped while the ring was full
+
+	enum RecordType {
+		RECORD_INSTR, // an instruction, with the registers it started with
+		RECORD_IRQ,   // interrupt taken, the handler follows
+		RECORD_NMI,
+		RECORD_LINES, // IRQ or NMI line changed
+		RECORD_LOST,  // records dropped here, the ring was full
+		// TRACE_BRANCHES, from pc to target
+		RECORD_BRANCH, // a taken Bxx, BBR or BBS
+		RECORD_JUMP,   // BRA, JMP
+		RECORD_CALL,   // JSR
+		RECORD_RETURN, // RTS
+		RECORD_RTI,
+		RECORD_BRK,
+		RECORD_SYNC,   // execution is at target
+	};
+
+	struct Record
+	{
+		uint8_t type;
+		uint64_t cycle;
+		uint16_t pc;
+		uint8_t opcode;
+		uint8_t length;     // of the instruction, 1 to 3
+		uint8_t operand[2];
+		uint8_t a, x, y, p, s;
+		uint32_t irqLines;  // RECORD_LINES
+		uint8_t nmiLine;
+		uint32_t lost;      // RECORD_LOST
+		uint16_t target;    // of a transfer, or the IRQ/NMI handler
+		bool direct;        // target not stored, it's in the code at pc or,
+		                    // for an interrupt, the next instruction
+	};
+
+	// Decodes a trace in memory, e.g. a mapped file. Every block decodes
+	// on its own, so data may also start at any block.
+	class Reader
+	{
+	public:
+		Reader(const uint8_t* data, size_t size);
+		bool Next(Record& record); // false at the end
+		bool Failed();             // stopped at a damaged block
+
+	private:
+		const uint8_t* data;
+		size_t size;
+		size_t offset; // of the next block
+		size_t pos;    // of the next record
+		size_t end;    // of the current block
+		uint32_t left; // records left in it
+		uint16_t next; // pc after the last instruction
+		uint8_t kind;  // of the current block
+		bool failed;
+		Record last;
+
+		bool NextBranch(uint8_t flags, Record& record);
+	};
+
+	// Rebuilds the path of a TRACE_BRANCHES trace from the code in memory,
+	// 64 KB as the processor saw them: straight on from one transfer to the
+	// next one recorded, where a branch that isn't is not taken. Code that
+	// changed while the trace was taken doesn't walk right, and the path
+	// after the last transfer isn't known.
+	class Walker
+	{
+	public:
+		Walker(const uint8_t* memory);
+		// Appends the addresses of the instructions executed up to the
+		// record, the transfer itself included. False where the code
+		// doesn't lead to it, or after a RECORD_LOST, the instructions in
+		// between are then missing.
+		bool Walk(const Record& record, std::vector<uint16_t>& path);
+		uint16_t GetPC(); // where execution went on after the last record
+
+	private:
+		const uint8_t* memory;
+		uint16_t pc;
+		bool synced;
+
+		bool Follow(uint16_t until, std::vector<uint16_t>& path);
+		uint16_t Target(uint16_t address);
+	};
+
+private:
+	struct Writer;
+
+	wdc65c02::TraceRing ring;
+	Writer* writer;
+	std::atomic<uint64_t> written; // bytes
+
+	void Write();
+
+	wdc65c02_trace(const wdc65c02_trace&);
+	wdc65c02_trace& operator=(const wdc65c02_trace&);
+};